@@ -340,6 +340,20 @@ void timer2_init( void )
 }
 
 
+// Restart the current second: clear the async prescaler and the counter
+// so the next overflow comes a full second after a host clock write
+void board_rtc_restart( void )
+{
+    GTCCR |= ( 1 << PSRASY );
+    TCNT2 = 0;
+    while ( ASSR & ( 1 << TCN2UB ) ) { /* wait */ }
+
+    // the old count can still overflow until the write reaches the
+    // asynchronous timer, so only clear the flag once it has
+    TIFR2 = ( 1 << TOV2 );
+}
+
+
 void board_init( void )
 {
     board_gpio_config();
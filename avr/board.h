@@ -66,6 +66,7 @@ void board_hold_reset( void );
 void board_release_reset( void );
 void board_set_charge_timer( uint8_t hours );
 void board_set_charge_current( uint8_t thirds );
+void board_rtc_restart( void );
 
 void board_enable_pgood_irq( void );
 void board_enable_interrupt( uint8_t mask );
@@ -28,38 +28,3 @@ uint8_t eeprom_get_calibration_value( void )
     return eeprom_read_byte( EEPROM_CALIBRATION );
 }
 
-
-uint8_t eeprom_get_board_type( void )
-{
-    return eeprom_read_byte( EEPROM_BOARD );
-}
-
-
-uint8_t eeprom_get_revision_value( void )
-{
-    return eeprom_read_byte( EEPROM_REVISION );
-}
-
-
-uint8_t eeprom_get_stepping_value( void )
-{
-    return eeprom_read_byte( EEPROM_STEPPING );
-}
-
-
-uint8_t eeprom_get_i2c_address( void )
-{
-    return eeprom_read_byte( EEPROM_I2C_ADDR );
-}
-
-
-uint8_t eeprom_get_charge_current( void )
-{
-    return eeprom_read_byte( EEPROM_CHG_CURRENT );
-}
-
-
-uint8_t eeprom_get_charge_timer( void )
-{
-    return eeprom_read_byte( EEPROM_CHG_TIMER );
-}
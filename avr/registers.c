@@ -2,6 +2,7 @@
 #include <avr/io.h>
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "registers.h"
 #include "eeprom.h"
 #include "twi_slave.h"
@@ -12,6 +13,8 @@ extern volatile uint32_t seconds;
 extern volatile uint8_t rebootflag;
 extern volatile uint8_t activity_watchdog;
 
+extern const register_desc registers_desc[ NUM_REGISTERS ] PROGMEM;
+
 static uint8_t registers[ NUM_REGISTERS ];
 
 // Internal interface
@@ -100,13 +103,44 @@ uint8_t registers_host_read( uint8_t index )
 }
 
 
+// Access, range and eeprom persistence come from the descriptor table
+// generated from registers.map; only side effects are handled here
 void registers_host_write( uint8_t index, uint8_t data )
 {
+    uint8_t flags = pgm_read_byte( &registers_desc[ index ].flags );
+    uint8_t min = pgm_read_byte( &registers_desc[ index ].min );
+    uint8_t max = pgm_read_byte( &registers_desc[ index ].max );
+
     if ( activity_watchdog )
     {
         activity_watchdog = 0;
     }
 
+    if ( flags & REG_FLAG_RO )
+    {
+        return;
+    }
+
+    if ( data == 0xFF && ( flags & REG_FLAG_ERASE ) )
+    {
+        // back to the reset value, now and after the next power up
+        if ( flags & REG_FLAG_EEPROM )
+        {
+            eeprom_update_byte( (uint8_t*)(uintptr_t)pgm_read_byte( &registers_desc[ index ].eeprom ), 0xFF );
+        }
+        registers[ index ] = pgm_read_byte( &registers_desc[ index ].reset );
+        return;
+    }
+
+    if ( data < min || data > max )
+    {
+        if ( !( flags & REG_FLAG_CLAMP ) )
+        {
+            return;
+        }
+        data = ( data < min ) ? min : max;
+    }
+
     switch ( index )
     {
         case REG_OSCCAL:
@@ -156,9 +190,8 @@ void registers_host_write( uint8_t index, uint8_t data )
         case REG_RESTART_MINUTES:
         case REG_RESTART_SECONDS:
         {
-            registers[ index ] = data;    
             registers_set_mask( REG_START_ENABLE, START_TIMEOUT );
-            return;
+            break;
         }
 
         case REG_SECONDS_0:
@@ -168,36 +201,23 @@ void registers_host_write( uint8_t index, uint8_t data )
         {
             registers[ index ] = data;    
             seconds = *(uint32_t*)&registers[ REG_SECONDS_0 ];
+            if ( index == REG_SECONDS_0 )
+            {
+                // the host writes the low byte first, at its second boundary
+                board_rtc_restart();
+            }
             return;
         }
         
-        case REG_EXTENDED:
-        {
-            // Don't let this register change
-            return;
-        }
-        
-        case REG_I2C_ADDRESS:
-        {
-            // TODO: qualify address
-            eeprom_update_byte( EEPROM_I2C_ADDR, data );    // TODO: interrupt context
-            break;
-        }
-
         case REG_I2C_ICHARGE:
         {
-            if ( data > 3 ) data = 3;
             board_set_charge_current( data );
-            eeprom_update_byte( EEPROM_CHG_CURRENT, data );    // TODO: interrupt context
             break;
         }
 
         case REG_I2C_TCHARGE:
         {
-            if ( data < 3 ) data = 3;
-            if ( data > 10 ) data = 10;
             board_set_charge_timer( data );
-            eeprom_update_byte( EEPROM_CHG_TIMER, data );    // TODO: interrupt context
             break;
         }
         
@@ -206,6 +226,12 @@ void registers_host_write( uint8_t index, uint8_t data )
             break;
         }
     }
+
+    if ( flags & REG_FLAG_EEPROM )
+    {
+        // TODO: interrupt context
+        eeprom_update_byte( (uint8_t*)(uintptr_t)pgm_read_byte( &registers_desc[ index ].eeprom ), data );
+    }
     
     registers[ index ] = data;    
 }
@@ -213,38 +239,21 @@ void registers_host_write( uint8_t index, uint8_t data )
 
 void registers_init( void )
 {
-    uint8_t t;
-    
-    registers[ REG_CONTROL ]         = CONTROL_CE;
-    registers[ REG_START_ENABLE ]    = START_ALL;
-    registers[ REG_RESTART_HOURS ]   = 0;
-    registers[ REG_RESTART_MINUTES ] = 0;
-    registers[ REG_RESTART_SECONDS ] = 0;
-    registers[ REG_EXTENDED ]        = 0x69;
-    registers[ REG_CAPABILITY ]      = CAPABILITY_STATUS;
-    registers[ REG_BOARD_TYPE ]      = eeprom_get_board_type();
-    registers[ REG_BOARD_REV ]       = eeprom_get_revision_value();
-    registers[ REG_BOARD_STEP ]      = eeprom_get_stepping_value();
+    uint8_t i, t;
     
-    t = eeprom_get_i2c_address();
-    if ( t == 0xFF )
+    for ( i = 0; i < NUM_REGISTERS; i++ )
     {
-        t = TWI_SLAVE_ADDRESS;
-    }
-    registers[ REG_I2C_ADDRESS ]     = t;
-    
-    t = eeprom_get_charge_current();
-    if ( t == 0xFF )
-    {
-        t = 1;  // 1/3 amp default
-    }
-    registers[ REG_I2C_ICHARGE ]     = t;
+        t = pgm_read_byte( &registers_desc[ i ].reset );
+        if ( pgm_read_byte( &registers_desc[ i ].flags ) & REG_FLAG_EEPROM )
+        {
+            uint8_t e = eeprom_read_byte( (uint8_t*)(uintptr_t)pgm_read_byte( &registers_desc[ i ].eeprom ) );
 
-    t = eeprom_get_charge_timer();
-    if ( t == 0xFF )
-    {
-        t = 3;  // 3 hours default
+            // 0xFF is an unprogrammed byte
+            if ( e != 0xFF )
+            {
+                t = e;
+            }
+        }
+        registers[ i ] = t;
     }
-    registers[ REG_I2C_TCHARGE ]      = t;
 }
-
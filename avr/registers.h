@@ -1,10 +1,12 @@
+/* generated by regmap.awk from registers.map, do not edit */
+
 #ifndef __REGISTERS_H__
 #define __REGISTERS_H__
 
 enum registers_type {
-    REG_MCUSR,                  // 0 - AVR register
-    REG_OSCCAL,                 // 1 - AVR register
-    REG_STATUS,                 // 2 
+    REG_MCUSR,                  // 0    AVR register
+    REG_OSCCAL,                 // 1    AVR register
+    REG_STATUS,                 // 2
     REG_CONTROL,                // 3
     REG_START_ENABLE,           // 4
     REG_START_REASON,           // 5
@@ -27,13 +29,12 @@ enum registers_type {
     REG_I2C_ADDRESS,            // 22   Slave address to use on I2C interface
     REG_I2C_ICHARGE,            // 23   Charge current (0-3)/3 amp
     REG_I2C_TCHARGE,            // 24   Charger timer in hours (3-10)
-    
+
     NUM_REGISTERS
 };
 
-
 // STATUS register bits
-#define STATUS_POWER_GOOD       0x01    // PG state 
+#define STATUS_POWER_GOOD       0x01    // PG state
 #define STATUS_BUTTON           0x02    // Button state
 #define STATUS_OPTO             0x04    // Opto state
 
@@ -56,13 +57,42 @@ enum registers_type {
 #define CAPABILITY_ADDR         0x02    // Programmable I2C address
 #define CAPABILITY_CHARGE       0x03    // Programmable charge current and timer
 #define CAPABILITY_STATUS       0x04    // Current button and opto state in status register
+#define CAPABILITY_RTC_SYNC     0x05    // Writing REG_SECONDS_0 restarts the RTC second
 
 // Board types
 #define BOARD_TYPE_BONE         0x00
 #define BOARD_TYPE_PI           0x01
 #define BOARD_TYPE_UNKNOWN      0xFF
 
+// EEPROM locations
+#define EEPROM_FLAGS            ( (uint8_t*)0 )
+#define EEPROM_CALIBRATION      ( (uint8_t*)1 )
+#define EEPROM_BOARD            ( (uint8_t*)2 )
+#define EEPROM_REVISION         ( (uint8_t*)3 )
+#define EEPROM_STEPPING         ( (uint8_t*)4 )
+#define EEPROM_I2C_ADDR         ( (uint8_t*)5 )
+#define EEPROM_CHG_CURRENT      ( (uint8_t*)6 )
+#define EEPROM_CHG_TIMER        ( (uint8_t*)7 )
+
+// Register descriptor flags
+#define REG_FLAG_RO             0x01    // host writes are ignored
+#define REG_FLAG_CLAMP          0x02    // out of range writes are limited to the range
+#define REG_FLAG_EEPROM         0x04    // kept in eeprom across power cycles
+#define REG_FLAG_FIXED          0x08    // constant while the firmware runs
+#define REG_FLAG_SHOW           0x10    // shown by the host info printer
+#define REG_FLAG_HEX            0x20    // shown in hex
+#define REG_FLAG_ERASE          0x40    // 0xFF restores the reset value
+
 #if defined( __AVR__ )
+// Access descriptor of a register byte, kept in flash (regtable.c)
+typedef struct {
+    uint8_t flags;
+    uint8_t min;
+    uint8_t max;
+    uint8_t eeprom;             // eeprom address with REG_FLAG_EEPROM
+    uint8_t reset;              // power up value, unless the eeprom holds one
+} register_desc;
+
 void registers_init( void );
 inline void registers_set_mask( uint8_t index, uint8_t mask );
 inline void registers_clear_mask( uint8_t index, uint8_t mask );
@@ -73,4 +103,3 @@ void registers_host_write( uint8_t idx, uint8_t data );
 #endif
 
 #endif  // __REGISTERS_H__
-
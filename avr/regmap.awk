@@ -0,0 +1,299 @@
+# Rickie Kerndt <rkerndt@cs.uoregon.edu>
+# regmap.awk
+#
+# Generates the register tables from registers.map, see the top of that
+# file. Pick the output with -v out=:
+#
+#     awk -v out=header -f regmap.awk registers.map > registers.h
+#     awk -v out=avr    -f regmap.awk registers.map > regtable.c
+#     awk -v out=host   -f regmap.awk registers.map > ../utils/regtable.c
+#     awk -v out=hpp    -f regmap.awk registers.map > ../utils/powercape_regs.hpp
+
+function rest( from,    s, i )
+{
+    s = ""
+    for ( i = from; i <= NF; i++ )
+    {
+        s = s ( s == "" ? "" : " " ) $i
+    }
+    return s
+}
+
+function fail( msg )
+{
+    printf( "registers.map:%d: %s\n", FNR, msg ) > "/dev/stderr"
+    error = 1
+    exit 1
+}
+
+function has_option( r, opt )
+{
+    return ( "," options[ r ] "," ) ~ ( "," opt "," )
+}
+
+function flags( r,    s )
+{
+    s = ""
+    if ( access[ r ] == "ro" )          s = s " | REG_FLAG_RO"
+    if ( has_option( r, "clamp" ) )     s = s " | REG_FLAG_CLAMP"
+    if ( eeprom[ r ] != "-" )           s = s " | REG_FLAG_EEPROM"
+    if ( has_option( r, "fixed" ) )     s = s " | REG_FLAG_FIXED"
+    if ( has_option( r, "show" ) )      s = s " | REG_FLAG_SHOW"
+    if ( has_option( r, "showhex" ) )   s = s " | REG_FLAG_SHOW | REG_FLAG_HEX"
+    if ( has_option( r, "erase" ) )     s = s " | REG_FLAG_ERASE"
+    return s == "" ? "0" : substr( s, 4 )
+}
+
+# smallest value a host may write, min unless hostmin= narrows it
+function host_min( r,    o )
+{
+    o = "," options[ r ] ","
+    if ( match( o, /,hostmin=[^,]+,/ ) )
+    {
+        return substr( o, RSTART + 9, RLENGTH - 10 )
+    }
+    return min[ r ]
+}
+
+function enum_name( r, byte )
+{
+    return "REG_" names[ r ] ( width[ r ] > 1 ? "_" byte : "" )
+}
+
+function c_string( s )
+{
+    gsub( /\\/, "\\\\", s )
+    gsub( /"/, "\\\"", s )
+    return "\"" s "\""
+}
+
+function capability_name( r, basic )
+{
+    return capability[ r ] == "basic" ? basic : "CAPABILITY_" capability[ r ]
+}
+
+function generated( opening, closing )
+{
+    printf( "%s generated by regmap.awk from registers.map, do not edit %s\n\n", opening, closing )
+}
+
+
+/^[ \t]*(#|$)/ {
+    next
+}
+
+$1 == "reg" {
+    if ( NF < 11 ) fail( "reg needs 10 fields" )
+    if ( $5 != "ro" && $5 != "rw" ) fail( "access is ro or rw" )
+    if ( $4 < 1 || $4 > 4 ) fail( "width is 1 to 4 bytes" )
+    nregs++
+    names[ nregs ] = $2
+    sdk[ nregs ] = $3
+    width[ nregs ] = $4
+    access[ nregs ] = $5
+    capability[ nregs ] = $6
+    min[ nregs ] = $7
+    max[ nregs ] = $8
+    reset[ nregs ] = $9
+    eeprom[ nregs ] = $10
+    options[ nregs ] = $11
+    comment[ nregs ] = rest( 12 )
+    index_of[ nregs ] = nbytes
+    nbytes += $4
+    next
+}
+
+$1 == "section" {
+    nconsts++
+    const_section[ nconsts ] = rest( 2 )
+    next
+}
+
+$1 == "const" {
+    if ( NF < 3 ) fail( "const needs a name and a value" )
+    nconsts++
+    const_name[ nconsts ] = $2
+    const_value[ nconsts ] = $3
+    const_comment[ nconsts ] = rest( 4 )
+    next
+}
+
+$1 == "eeprom" {
+    if ( NF != 3 ) fail( "eeprom needs a name and an address" )
+    nconsts++
+    const_name[ nconsts ] = "EEPROM_" $2
+    const_value[ nconsts ] = "( (uint8_t*)" $3 " )"
+    eeprom_address[ $2 ] = $3
+    next
+}
+
+{
+    fail( "unknown record " $1 )
+}
+
+
+END {
+    if ( error )
+    {
+        exit 1
+    }
+
+    for ( r = 1; r <= nregs; r++ )
+    {
+        if ( eeprom[ r ] != "-" && !( eeprom[ r ] in eeprom_address ) )
+        {
+            printf( "registers.map: %s names unknown eeprom %s\n", names[ r ], eeprom[ r ] ) > "/dev/stderr"
+            exit 1
+        }
+    }
+
+    if ( out == "header" )
+    {
+        generated( "/*", "*/" )
+        print "#ifndef __REGISTERS_H__"
+        print "#define __REGISTERS_H__"
+        print ""
+        print "enum registers_type {"
+        for ( r = 1; r <= nregs; r++ )
+        {
+            for ( b = 0; b < width[ r ]; b++ )
+            {
+                line = sprintf( "    %-28s// %-5d%s", enum_name( r, b ) ",", index_of[ r ] + b,
+                                b == 0 ? comment[ r ] : "\"" )
+                sub( / +$/, "", line )
+                print line
+            }
+        }
+        print ""
+        print "    NUM_REGISTERS"
+        print "};"
+
+        for ( c = 1; c <= nconsts; c++ )
+        {
+            if ( c in const_section )
+            {
+                printf( "\n// %s\n", const_section[ c ] )
+            }
+            else if ( const_comment[ c ] != "" )
+            {
+                printf( "#define %-24s%-8s// %s\n", const_name[ c ], const_value[ c ], const_comment[ c ] )
+            }
+            else
+            {
+                printf( "#define %-24s%s\n", const_name[ c ], const_value[ c ] )
+            }
+        }
+
+        print ""
+        print "// Register descriptor flags"
+        print "#define REG_FLAG_RO             0x01    // host writes are ignored"
+        print "#define REG_FLAG_CLAMP          0x02    // out of range writes are limited to the range"
+        print "#define REG_FLAG_EEPROM         0x04    // kept in eeprom across power cycles"
+        print "#define REG_FLAG_FIXED          0x08    // constant while the firmware runs"
+        print "#define REG_FLAG_SHOW           0x10    // shown by the host info printer"
+        print "#define REG_FLAG_HEX            0x20    // shown in hex"
+        print "#define REG_FLAG_ERASE          0x40    // 0xFF restores the reset value"
+        print ""
+        print "#if defined( __AVR__ )"
+        print "// Access descriptor of a register byte, kept in flash (regtable.c)"
+        print "typedef struct {"
+        print "    uint8_t flags;"
+        print "    uint8_t min;"
+        print "    uint8_t max;"
+        print "    uint8_t eeprom;             // eeprom address with REG_FLAG_EEPROM"
+        print "    uint8_t reset;              // power up value, unless the eeprom holds one"
+        print "} register_desc;"
+        print ""
+        print "void registers_init( void );"
+        print "inline void registers_set_mask( uint8_t index, uint8_t mask );"
+        print "inline void registers_clear_mask( uint8_t index, uint8_t mask );"
+        print "inline uint8_t registers_get( uint8_t index );"
+        print "inline void registers_set( uint8_t idx, uint8_t data );"
+        print "uint8_t registers_host_read( uint8_t idx );"
+        print "void registers_host_write( uint8_t idx, uint8_t data );"
+        print "#endif"
+        print ""
+        print "#endif  // __REGISTERS_H__"
+    }
+    else if ( out == "avr" )
+    {
+        generated( "/*", "*/" )
+        print "#include <stdint.h>"
+        print "#include <avr/pgmspace.h>"
+        print "#include \"registers.h\""
+        print "#include \"twi_slave.h\""
+        print ""
+        print ""
+        print "const register_desc registers_desc[ NUM_REGISTERS ] PROGMEM = {"
+        for ( r = 1; r <= nregs; r++ )
+        {
+            e = eeprom[ r ] == "-" ? 0 : eeprom_address[ eeprom[ r ] ]
+            for ( b = 0; b < width[ r ]; b++ )
+            {
+                if ( width[ r ] == 1 )
+                {
+                    entry = sprintf( "%s, %s, %s, %s, %s", flags( r ), min[ r ], max[ r ], e, reset[ r ] )
+                }
+                else
+                {
+                    # a range applies to the whole value, not to its bytes
+                    part = reset[ r ] == "0" ? "0" : sprintf( "( ( %s ) >> %d ) & 0xFF", reset[ r ], 8 * b )
+                    entry = sprintf( "%s, 0, 0xFF, %s, %s", flags( r ), e, part )
+                }
+                printf( "    [ %s ] = { %s },\n", enum_name( r, b ), entry )
+            }
+        }
+        print "};"
+    }
+    else if ( out == "host" )
+    {
+        generated( "/*", "*/" )
+        print "#include \"powercape.h\""
+        print ""
+        print ""
+        print "const cape_register_desc cape_register_map[] = {"
+        for ( r = 1; r <= nregs; r++ )
+        {
+            printf( "    { %s, %s, %s, %d, %s, %s, %s, %s },\n", c_string( sdk[ r ] ), c_string( comment[ r ] ),
+                    enum_name( r, 0 ), width[ r ], capability_name( r, "-1" ), flags( r ), host_min( r ), max[ r ] )
+        }
+        print "};"
+        print ""
+        print "const int cape_register_count = sizeof( cape_register_map ) / sizeof( cape_register_map[ 0 ] );"
+    }
+    else if ( out == "hpp" )
+    {
+        generated( "//", "" )
+        print "// Included by powercape.hpp inside namespace capesdk"
+        print ""
+        print "namespace regs {"
+        print ""
+        for ( r = 1; r <= nregs; r++ )
+        {
+            printf( "using %-15s = descriptor< %s, %d, reg_access::%s, %s, %s, %s >;\n", sdk[ r ],
+                    enum_name( r, 0 ), width[ r ], access[ r ] == "ro" ? "read_only" : "read_write",
+                    capability_name( r, "capability_basic" ), host_min( r ), max[ r ] )
+        }
+        print ""
+        print "// every register once, in order"
+        line = "using all = std::tuple<"
+        for ( r = 1; r <= nregs; r++ )
+        {
+            sep = r < nregs ? "," : " >;"
+            if ( length( line ) + length( sdk[ r ] ) + 2 > 100 )
+            {
+                print line
+                line = "                       "
+            }
+            line = line " " sdk[ r ] sep
+        }
+        print line
+        print ""
+        print "}   // namespace regs"
+    }
+    else
+    {
+        print "regmap.awk: out is header, avr, host or hpp" > "/dev/stderr"
+        exit 1
+    }
+}
@@ -0,0 +1,35 @@
+/* generated by regmap.awk from registers.map, do not edit */
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "registers.h"
+#include "twi_slave.h"
+
+
+const register_desc registers_desc[ NUM_REGISTERS ] PROGMEM = {
+    [ REG_MCUSR ] = { REG_FLAG_RO, 0, 0xFF, 0, 0 },
+    [ REG_OSCCAL ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_STATUS ] = { REG_FLAG_RO, 0, 0xFF, 0, 0 },
+    [ REG_CONTROL ] = { 0, 0, 0xFF, 0, CONTROL_CE },
+    [ REG_START_ENABLE ] = { 0, 0, START_ALL, 0, START_ALL },
+    [ REG_START_REASON ] = { 0, 0, START_ALL, 0, 0 },
+    [ REG_RESTART_HOURS ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_RESTART_MINUTES ] = { 0, 0, 59, 0, 0 },
+    [ REG_RESTART_SECONDS ] = { 0, 0, 59, 0, 0 },
+    [ REG_SECONDS_0 ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_SECONDS_1 ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_SECONDS_2 ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_SECONDS_3 ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_EXTENDED ] = { REG_FLAG_RO | REG_FLAG_FIXED, 0, 0xFF, 0, 0x69 },
+    [ REG_CAPABILITY ] = { REG_FLAG_RO | REG_FLAG_FIXED, 0, 0xFF, 0, CAPABILITY_RTC_SYNC },
+    [ REG_BOARD_TYPE ] = { REG_FLAG_RO | REG_FLAG_EEPROM | REG_FLAG_FIXED, 0, 0xFF, 2, BOARD_TYPE_UNKNOWN },
+    [ REG_BOARD_REV ] = { REG_FLAG_RO | REG_FLAG_EEPROM | REG_FLAG_FIXED, 0, 0xFF, 3, 0xFF },
+    [ REG_BOARD_STEP ] = { REG_FLAG_RO | REG_FLAG_EEPROM | REG_FLAG_FIXED, 0, 0xFF, 4, 0xFF },
+    [ REG_WDT_RESET ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_WDT_POWER ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_WDT_STOP ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_WDT_START ] = { 0, 0, 0xFF, 0, 0 },
+    [ REG_I2C_ADDRESS ] = { REG_FLAG_EEPROM | REG_FLAG_ERASE, 0x08, 0x77, 5, TWI_SLAVE_ADDRESS },
+    [ REG_I2C_ICHARGE ] = { REG_FLAG_CLAMP | REG_FLAG_EEPROM, 0, 3, 6, 1 },
+    [ REG_I2C_TCHARGE ] = { REG_FLAG_CLAMP | REG_FLAG_EEPROM, 3, 10, 7, 3 },
+};
@@ -80,6 +80,9 @@ void twi_slave_init( void )
     uint8_t i;
     
     i = registers_get( REG_I2C_ADDRESS );
+
+    // a host write of 0xFF erases the eeprom byte, so the reset value is
+    // loaded instead; this catches bytes older firmware stored unchecked
     if ( i & 0x80 )
     {
         i = TWI_SLAVE_ADDRESS;
@@ -31,6 +31,7 @@
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
+#include "buslock.h"
 #include "chipinfo_avr.h"
 #include "filedata.h"
 #include "list.h"
@@ -70,6 +71,7 @@ struct twi_privdata {
     char        *device;
     uint8_t     address;
     int         fd;
+    int         lock;           /* bus lock shared with the powercape utils */
     int         connected;
 
     uint8_t     pagesize;
@@ -82,23 +84,46 @@ static struct option twi_optargs[] = {
     {"device",      1, 0, 'd'}, /* [ -d <device> ] */
 };
 
+/*
+ * a command and the read answering it are separate transfers, the bus lock
+ * keeps other programs from addressing the avr in between
+ */
+static void twi_lock(struct twi_privdata *twi)
+{
+    if (twi->lock >= 0)
+        buslock_acquire(twi->lock, BUSLOCK_NORMAL, NULL);
+}
+
+static void twi_unlock(struct twi_privdata *twi)
+{
+    if (twi->lock >= 0)
+        buslock_release(twi->lock, NULL);
+}
+
 static int twi_switch_application(struct twi_privdata *twi, uint8_t application)
 {
     uint8_t cmd[] = { CMD_SWITCH_APPLICATION, application };
 
-    return (write(twi->fd, cmd, sizeof(cmd)) != sizeof(cmd));
+    twi_lock(twi);
+    int result = write(twi->fd, cmd, sizeof(cmd));
+    twi_unlock(twi);
+
+    return (result != sizeof(cmd));
 }
 
 static int twi_read_version(struct twi_privdata *twi, char *version, int length)
 {
     uint8_t cmd[] = { CMD_READ_VERSION };
 
-    if (write(twi->fd, cmd, sizeof(cmd)) != sizeof(cmd))
-        return -1;
-
     memset(version, 0, length);
-    if (read(twi->fd, version, length) != length)
+
+    twi_lock(twi);
+    if (write(twi->fd, cmd, sizeof(cmd)) != sizeof(cmd) ||
+        read(twi->fd, version, length) != length) {
+        twi_unlock(twi);
         return -1;
+    }
+    twi_unlock(twi);
 
     int i;
     for (i = 0; i < length; i++)
@@ -110,10 +135,14 @@ static int twi_read_version(struct twi_privdata *twi, char *version, int length)
 static int twi_read_memory(struct twi_privdata *twi, uint8_t *buffer, uint8_t size, uint8_t memtype, uint16_t address)
 {
     uint8_t cmd[] = { CMD_READ_MEMORY, memtype, (address >> 8) & 0xFF, (address & 0xFF) };
-    if (write(twi->fd, cmd, sizeof(cmd)) != sizeof(cmd))
-        return -1;
+    int result = -1;
 
-    return (read(twi->fd, buffer, size) != size);
+    twi_lock(twi);
+    if (write(twi->fd, cmd, sizeof(cmd)) == sizeof(cmd))
+        result = (read(twi->fd, buffer, size) != size);
+
+    twi_unlock(twi);
+    return result;
 }
 
 static int twi_write_memory(struct twi_privdata *twi, uint8_t *buffer, uint8_t size, uint8_t memtype, uint16_t address)
@@ -144,7 +173,9 @@ static int twi_write_memory(struct twi_privdata *twi, uint8_t *buffer, uint8_t s
         memset(cmd +4 +size, 0xFF, twi->pagesize - size);
     }
 
+    twi_lock(twi);
     int result = write(twi->fd, cmd, bufsize);
+    twi_unlock(twi);
     free(cmd);
 
     return (result != bufsize);
@@ -152,9 +183,12 @@ static int twi_write_memory(struct twi_privdata *twi, uint8_t *buffer, uint8_t s
 
 static void twi_close_device(struct twi_privdata *twi)
 {
-    if (twi->connected)
+    if (twi->connected) {
         close(twi->fd);
+        buslock_close(twi->lock);
+    }
 
+    twi->lock = -1;
     twi->connected = 0;
 }
 
@@ -185,6 +219,10 @@ static int twi_open_device(struct twi_privdata *twi)
         return -1;
     }
 
+    /* bus number from /dev/i2c-<n> */
+    const char *bus = strrchr(twi->device, '-');
+    twi->lock = (bus != NULL) ? buslock_open(atoi(bus +1)) : -1;
+
     twi->connected = 1;
     return 0;
 }
@@ -413,6 +451,7 @@ static struct multiboot * twi_alloc(void)
     memset(twi, 0x00, sizeof(struct twi_privdata));
     twi->device  = NULL;
     twi->address = 0;
+    twi->lock    = -1;
 
     optarg_register(twi_optargs, ARRAY_SIZE(twi_optargs), twi_optarg_cb, (void *)twi);
 
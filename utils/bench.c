@@ -0,0 +1,440 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * bench.c
+ *
+ * Runs each public cape_* call and the INA219 read paths repeatedly and
+ * reports latency percentiles along with bus transactions, system calls,
+ * bytes and modeled bus time per operation. Uses the emulated cape unless
+ * told to use the hardware. The boot clock restore is also timed as a
+ * whole process, capeboot from exec to exit.
+ *
+ * The operations that write the cape (rtc, charge settings, countdowns)
+ * only run on the hardware when asked to, and the registers they change
+ * are put back after each of them.
+ */
+
+
+#include <getopt.h>
+#include <sys/wait.h>
+#include "powercape.h"
+#include "ina.h"
+
+typedef struct {
+    const char *name;
+    int (*run)(void);
+    int max_runs;                   // cap on --iterations for slow operations, 0 for none
+    int writes;                     // changes cape settings, restored after
+} bench_op;
+
+static int iterations = 10000;
+static int hardware = 0;
+static int i2c_bus = CAPE_I2C_BUS;
+static int cached = 0;
+static int writes = 0;
+
+// next to capebench unless --capeboot says otherwise; without a directory,
+// searched for in PATH
+static char capeboot_path[ 256 ] = "capeboot";
+
+static transport_t *bus;
+static cape_t *cape;
+static ina_t *ina;
+
+// the cape as it was before the run, and its rtc less the system clock
+static cape_registers saved;
+static long rtc_offset;
+
+
+static int op_snapshot( void )
+{
+    cape_registers regs;
+    return cape_snapshot_r( cape, &regs );
+}
+
+static int op_info( void )
+{
+    return cape_show_cape_info_r( cape );
+}
+
+static int op_query( void )
+{
+    return cape_query_reason_power_on_r( cape );
+}
+
+static int op_boot_seconds( void )
+{
+    time_t t;
+    return cape_boot_seconds_r( cape, &t );
+}
+
+// A child's bus use is not in this process's stats, so only its time counts
+static int op_boot_process( void )
+{
+    char bus_arg[ 16 ];
+    int status;
+    pid_t pid;
+
+    pid = fork();
+    if ( pid == 0 )
+    {
+        snprintf( bus_arg, sizeof( bus_arg ), "%d", i2c_bus );
+        if ( !hardware )
+        {
+            setenv( TRANSPORT_ENV, "emulator", 1 );
+        }
+        execlp( capeboot_path, "capeboot", "-n", bus_arg, (char*)NULL );
+        fprintf( stderr, "Error running %s: %s\n", capeboot_path, strerror( errno ) );
+        _exit( 127 );
+    }
+    if ( pid < 0 || waitpid( pid, &status, 0 ) < 0 )
+    {
+        return -1;
+    }
+
+    return WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ? 0 : 1;
+}
+
+static int op_read_rtc( void )
+{
+    time_t t;
+    return cape_read_rtc_r( cape, &t );
+}
+
+static int op_write_rtc( void )
+{
+    return cape_write_rtc_r( cape );
+}
+
+static int op_charge_rate( void )
+{
+    return cape_charge_rate_r( cape, CHARGE_RATE_LOW );
+}
+
+static int op_charge_time( void )
+{
+    return cape_charge_time_r( cape, CHARGE_TIME_MIN );
+}
+
+static int op_power_down( void )
+{
+    // disarmed again right away so the emulated countdown never fires
+    return cape_power_down_r( cape, POWER_DOWN_MAX_SEC ) | cape_register_write_r( cape, REG_WDT_STOP, 0 );
+}
+
+static int op_power_on( void )
+{
+    return cape_power_on_r( cape, 3600 + 60 + 1 );
+}
+
+static int op_ina_voltage( void )
+{
+    float mv;
+    return ina_get_voltage( ina, &mv );
+}
+
+static int op_ina_current( void )
+{
+    float ma;
+    return ina_get_current( ina, &ma );
+}
+
+static int op_ina_sample( void )
+{
+    float mv, ma;
+    return ina_get_voltage( ina, &mv ) | ina_get_current( ina, &ma );
+}
+
+// cape_enter_bootloader_r() is left out: the cape leaves the bus after it
+static const bench_op ops[] = {
+    { "cape_snapshot",              op_snapshot,        0,      0 },
+    { "cape_show_cape_info",        op_info,            0,      0 },
+    { "cape_query_reason_power_on", op_query,           0,      0 },
+    { "cape_boot_seconds",          op_boot_seconds,    0,      0 },
+    { "capeboot -n (process)",      op_boot_process,    1000,   0 },
+    { "cape_read_rtc",              op_read_rtc,        0,      0 },
+    { "cape_write_rtc",             op_write_rtc,       0,      1 },
+    { "cape_charge_rate",           op_charge_rate,     0,      1 },
+    { "cape_charge_time",           op_charge_time,     0,      1 },
+    { "cape_power_down",            op_power_down,      0,      1 },
+    { "cape_power_on",              op_power_on,        0,      1 },
+    { "ina_get_voltage",            op_ina_voltage,     0,      0 },
+    { "ina_get_current",            op_ina_current,     0,      0 },
+    { "ina sample (mV + mA)",       op_ina_sample,      0,      0 },
+    { NULL,                         NULL,               0,      0 },
+};
+
+
+// Keep what the writing operations change: the rtc as an offset from the
+// system clock, so it is put back where it would have got to
+static int save_cape( void )
+{
+    if ( cape_snapshot_r( cape, &saved ) != 0 )
+    {
+        return -1;
+    }
+
+    rtc_offset = (long)cape_snapshot_seconds( &saved ) - (long)time( NULL );
+    return 0;
+}
+
+
+// Put back what a writing operation changed: the rtc, the restart
+// countdown (disarming the one cape_power_on armed), the power-off
+// countdown and the eeprom kept charge settings
+static int restore_cape( void )
+{
+    unsigned int seconds = (unsigned int)( time( NULL ) + rtc_offset );
+    unsigned char rtc[ 4 ];
+    int rc = 0;
+    int i;
+
+    for ( i = 0; i < 4; i++ )
+    {
+        rtc[ i ] = ( seconds >> ( 8 * i ) ) & 0xFF;
+    }
+
+    rc |= cape_register_block_write_r( cape, REG_SECONDS_0, rtc, 4 );
+    rc |= cape_register_block_write_r( cape, REG_RESTART_HOURS, &saved.reg[ REG_RESTART_HOURS ], 3 );
+    if ( cape_snapshot_capability( &saved ) >= CAPABILITY_WDT )
+    {
+        rc |= cape_register_write_r( cape, REG_WDT_STOP, saved.reg[ REG_WDT_STOP ] );
+    }
+    if ( cape_snapshot_capability( &saved ) >= CAPABILITY_CHARGE )
+    {
+        rc |= cape_register_block_write_r( cape, REG_I2C_ICHARGE, &saved.reg[ REG_I2C_ICHARGE ], 2 );
+    }
+
+    if ( rc != 0 )
+    {
+        fprintf( stderr, "Could not restore the cape registers after the benchmark\n" );
+    }
+    return rc;
+}
+
+
+void show_usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [OPTION] \n", progname );
+    fprintf( stderr, "   Options:\n" );
+    fprintf( stderr, "      -h --help           Show usage.\n" );
+    fprintf( stderr, "      -n --iterations n   Calls per operation (default %d).\n", iterations );
+    fprintf( stderr, "      -H --hardware       Use /dev/i2c-N instead of the emulated cape.\n" );
+    fprintf( stderr, "      -b --bus n          I2C bus for --hardware (default %d).\n", CAPE_I2C_BUS );
+    fprintf( stderr, "      -c --cached         Leave the register cache on (default every call reads the bus).\n" );
+    fprintf( stderr, "      -w --writes         With --hardware, also time the calls that write the cape;\n" );
+    fprintf( stderr, "                          the registers they change are restored after each.\n" );
+    fprintf( stderr, "      -B --capeboot path  capeboot to time (default the one next to %s).\n", progname );
+    exit( 1 );
+}
+
+
+void parse( int argc, char *argv[] )
+{
+    while( 1 )
+    {
+        static const struct option lopts[] =
+        {
+            { "help",        0, 0, 'h' },
+            { "iterations",  1, 0, 'n' },
+            { "hardware",    0, 0, 'H' },
+            { "bus",         1, 0, 'b' },
+            { "cached",      0, 0, 'c' },
+            { "writes",      0, 0, 'w' },
+            { "capeboot",    1, 0, 'B' },
+            { NULL,          0, 0, 0 },
+        };
+        int c;
+
+        c = getopt_long( argc, argv, "hn:Hb:cwB:", lopts, NULL );
+
+        if( c == -1 )
+            break;
+
+        switch( c )
+        {
+            case 'n':
+            {
+                iterations = atoi( optarg );
+                if ( iterations <= 0 )
+                {
+                    show_usage( argv[ 0 ] );
+                }
+                break;
+            }
+
+            case 'H':
+            {
+                hardware = 1;
+                break;
+            }
+
+            case 'b':
+            {
+                i2c_bus = (int)strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            case 'c':
+            {
+                cached = 1;
+                break;
+            }
+
+            case 'w':
+            {
+                writes = 1;
+                break;
+            }
+
+            case 'B':
+            {
+                snprintf( capeboot_path, sizeof( capeboot_path ), "%s", optarg );
+                break;
+            }
+
+            default:
+            case 'h':
+            {
+                show_usage( argv[ 0 ] );
+                break;
+            }
+        }
+    }
+}
+
+
+static int compare_ns( const void *a, const void *b )
+{
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+
+    return ( x > y ) - ( x < y );
+}
+
+
+static double percentile_us( long *samples, int count, double p )
+{
+    int i = (int)( p * ( count - 1 ) + 0.5 );
+
+    return samples[ i ] / 1000.0;
+}
+
+
+void run_op( const bench_op *op, long *samples, int quiet_fd, int stdout_fd )
+{
+    transport_stats before, after;
+    struct timespec t0, t1;
+    int failures = 0;
+    int runs = ( op->max_runs && op->max_runs < iterations ) ? op->max_runs : iterations;
+    double n = runs;
+    int i;
+
+    if ( op->writes && hardware && !writes )
+    {
+        printf( "%-28s skipped, writes the cape (--writes)\n", op->name );
+        return;
+    }
+
+    before = bus->stats;
+
+    // the info and rtc calls print; keep that off the terminal but in the cost
+    fflush( stdout );
+    dup2( quiet_fd, STDOUT_FILENO );
+    for ( i = 0; i < runs; i++ )
+    {
+        clock_gettime( CLOCK_MONOTONIC, &t0 );
+        if ( op->run() != 0 )
+        {
+            failures++;
+        }
+        clock_gettime( CLOCK_MONOTONIC, &t1 );
+        samples[ i ] = ( t1.tv_sec - t0.tv_sec ) * 1000000000L + ( t1.tv_nsec - t0.tv_nsec );
+    }
+    fflush( stdout );
+    dup2( stdout_fd, STDOUT_FILENO );
+
+    after = bus->stats;
+    if ( op->writes )
+    {
+        restore_cape();
+    }
+    qsort( samples, runs, sizeof( long ), compare_ns );
+
+    printf( "%-28s %8.1f %8.1f %8.1f %8.1f %6.1f %6.1f %6.1f %8.0f",
+            op->name,
+            percentile_us( samples, runs, 0.50 ),
+            percentile_us( samples, runs, 0.90 ),
+            percentile_us( samples, runs, 0.99 ),
+            samples[ runs - 1 ] / 1000.0,
+            ( after.transfers - before.transfers ) / n,
+            ( after.syscalls - before.syscalls ) / n,
+            ( after.bytes - before.bytes ) / n,
+            ( after.bus_bits - before.bus_bits ) / n * 1000000.0 / TRANSPORT_BUS_HZ );
+    if ( failures )
+    {
+        printf( "  (%d failed)", failures );
+    }
+    printf( "\n" );
+}
+
+
+int main( int argc, char *argv[] )
+{
+    long *samples;
+    int quiet_fd, stdout_fd;
+    char *slash;
+    int i;
+
+    // capebench and capeboot are built and installed side by side
+    slash = strrchr( argv[ 0 ], '/' );
+    if ( slash != NULL )
+    {
+        snprintf( capeboot_path, sizeof( capeboot_path ), "%.*scapeboot", (int)( slash - argv[ 0 ] + 1 ), argv[ 0 ] );
+    }
+    parse( argc, argv );
+
+    bus = hardware ? transport_open_i2cdev( i2c_bus ) : transport_open_emulator( i2c_bus );
+    if ( bus == NULL )
+    {
+        exit( 1 );
+    }
+
+    cape = cape_attach( bus, AVR_ADDRESS );
+    ina = ina_attach( bus, INA_ADDRESS );
+    samples = malloc( iterations * sizeof( long ) );
+    quiet_fd = open( "/dev/null", O_WRONLY );
+    stdout_fd = dup( STDOUT_FILENO );
+    if ( cape == NULL || ina == NULL || samples == NULL || quiet_fd < 0 || stdout_fd < 0 )
+    {
+        fprintf( stderr, "Benchmark setup failed\n" );
+        exit( 1 );
+    }
+
+    // measure the bus unless asked to measure the cache
+    for ( i = 0; !cached && i < NUM_REGISTERS; i++ )
+    {
+        cape_cache_ttl_r( cape, i, CAPE_CACHE_NEVER );
+    }
+
+    if ( save_cape() != 0 )
+    {
+        fprintf( stderr, "Could not read the cape\n" );
+        exit( 1 );
+    }
+
+    printf( "%s transport, %d iterations, register cache %s, bus time modeled at %d kHz\n\n",
+            bus->ops->name, iterations, cached ? "on" : "off", TRANSPORT_BUS_HZ / 1000 );
+    printf( "%-28s %8s %8s %8s %8s %6s %6s %6s %8s\n",
+            "operation", "p50 us", "p90 us", "p99 us", "max us",
+            "xfer", "sys", "bytes", "bus us" );
+
+    for ( i = 0; ops[ i ].name != NULL; i++ )
+    {
+        run_op( &ops[ i ], samples, quiet_fd, stdout_fd );
+    }
+
+    free( samples );
+    ina_close( ina );
+    cape_close_r( cape );
+    transport_close( bus );
+    return 0;
+}
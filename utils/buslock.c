@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "buslock.h"
+
+// lock file layout: the bus byte, then a waiting mark per priority
+#define BUSLOCK_BUS         0
+#define MARK( priority )    ( 1 + ( priority ) )
+
+
+static int lock_range( int fd, int cmd, short type, off_t start, off_t len, unsigned long *syscalls )
+{
+    struct flock fl;
+
+    memset( &fl, 0, sizeof( fl ) );
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+
+    if ( syscalls != NULL )
+    {
+        ( *syscalls )++;
+    }
+    return fcntl( fd, cmd, &fl );
+}
+
+
+// Whether another open has marked a waiter at priority or above, for any
+// address on the bus
+static int waiting( int fd, int priority, unsigned long *syscalls )
+{
+    struct flock fl;
+
+    if ( priority >= BUSLOCK_PRIORITIES )
+    {
+        return 0;
+    }
+
+    memset( &fl, 0, sizeof( fl ) );
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = MARK( priority );
+    fl.l_len = BUSLOCK_PRIORITIES - priority;
+
+    if ( syscalls != NULL )
+    {
+        ( *syscalls )++;
+    }
+    return fcntl( fd, F_OFD_GETLK, &fl ) == 0 && fl.l_type != F_UNLCK;
+}
+
+
+// The lock file is shared by all users of the bus, whoever creates it.
+// It lives in a world writable directory, so it is never followed through
+// a symlink, must be a plain file with one link, and must belong to root
+// or to us without being writable by everyone: anyone able to write it
+// could hold the bus. A new one is 0660 in the group of /dev/i2c-N, the
+// group allowed on the bus.
+int buslock_open( int i2c_bus )
+{
+    const char *dir = getenv( BUSLOCK_DIR_ENV );
+    char path[ 256 ], device[ 32 ];
+    struct stat st;
+    int fd;
+
+    snprintf( path, sizeof( path ), "%s/i2c-%d.lock", dir != NULL ? dir : BUSLOCK_DIR, i2c_bus );
+    fd = open( path, O_RDWR | O_NOFOLLOW | O_CLOEXEC );
+    if ( fd < 0 && errno == ENOENT )
+    {
+        fd = open( path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0660 );
+        snprintf( device, sizeof( device ), "/dev/i2c-%d", i2c_bus );
+        if ( fd >= 0 && stat( device, &st ) == 0 && fchown( fd, -1, st.st_gid ) != 0 )
+        {
+            fprintf( stderr, "Warning: %s is not shared with the group of %s\n", path, device );
+        }
+    }
+    if ( fd < 0 )
+    {
+        fprintf( stderr, "Warning: no bus lock, %s: %s\n", path, strerror( errno ) );
+        return -1;
+    }
+
+    if ( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) || st.st_nlink != 1 ||
+         ( st.st_uid != 0 && st.st_uid != geteuid() ) || ( st.st_mode & S_IWOTH ) )
+    {
+        fprintf( stderr, "Warning: no bus lock, %s is not a private lock file\n", path );
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static long long monotonic_ms( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+// 0 when the lock was free, 1 when it had to wait, -1 on error. The lock
+// is only taken straight away when nobody of the same or higher priority
+// is waiting, so a program taking it in a loop queues behind the others;
+// among waiters of one priority the first to look again gets it. An
+// urgent waiter gives up after BUSLOCK_URGENT_WAIT_MS (errno ETIMEDOUT),
+// so a stuck or hostile holder cannot keep a watchdog refresh off the bus.
+int buslock_acquire( int fd, buslock_priority priority, unsigned long *syscalls )
+{
+    long long deadline = 0;
+
+    if ( !waiting( fd, priority, syscalls ) &&
+         lock_range( fd, F_OFD_SETLK, F_WRLCK, BUSLOCK_BUS, 1, syscalls ) == 0 )
+    {
+        return 0;
+    }
+
+    if ( priority == BUSLOCK_URGENT )
+    {
+        deadline = monotonic_ms() + BUSLOCK_URGENT_WAIT_MS;
+    }
+
+    // nobody blocks in the kernel, which could grant a blocked request
+    // ahead of a higher waiter; each looks again until nobody above is
+    // marked and the bus is free
+    lock_range( fd, F_OFD_SETLK, F_RDLCK, MARK( priority ), 1, syscalls );
+    while ( 1 )
+    {
+        if ( !waiting( fd, priority + 1, syscalls ) )
+        {
+            if ( lock_range( fd, F_OFD_SETLK, F_WRLCK, BUSLOCK_BUS, 1, syscalls ) == 0 )
+                break;
+
+            if ( errno != EAGAIN && errno != EACCES )
+            {
+                lock_range( fd, F_OFD_SETLK, F_UNLCK, MARK( priority ), 1, syscalls );
+                return -1;
+            }
+        }
+
+        if ( deadline != 0 && monotonic_ms() >= deadline )
+        {
+            lock_range( fd, F_OFD_SETLK, F_UNLCK, MARK( priority ), 1, syscalls );
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        usleep( BUSLOCK_YIELD_US );
+    }
+    lock_range( fd, F_OFD_SETLK, F_UNLCK, MARK( priority ), 1, syscalls );
+
+    return 1;
+}
+
+
+void buslock_release( int fd, unsigned long *syscalls )
+{
+    lock_range( fd, F_OFD_SETLK, F_UNLCK, BUSLOCK_BUS, 1, syscalls );
+}
+
+
+void buslock_close( int fd )
+{
+    if ( fd >= 0 )
+    {
+        close( fd );
+    }
+}
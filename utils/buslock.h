@@ -0,0 +1,67 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * buslock.h
+ *
+ * Advisory lock shared by every program that talks to a device on an
+ * i2c bus (power, powercaped, capewdt, ina219, twiboot). One lock file per
+ * bus; a program holds the bus across each exchange, so a register
+ * pointer written by one program is not moved by another before the read
+ * that follows it, and the bus goes to one device at a time whichever
+ * address each program talks to.
+ *
+ * Waiters mark their priority with a shared lock on a byte of the bus
+ * lock file and a waiter yields while a higher priority one is marked, so
+ * a watchdog refresh at the cape is not left queued behind INA219 monitor
+ * sampling. Waiters look again every BUSLOCK_YIELD_US rather than sleep
+ * in the kernel, which could hand the bus to a lower waiter first, and an
+ * urgent one stops waiting after BUSLOCK_URGENT_WAIT_MS. Locks are open
+ * file description locks: released when the holder exits, and separate
+ * for each open even within one process.
+ *
+ * The lock file is only shared with the bus device's group and is never
+ * opened through a symlink, see buslock_open().
+ *
+ * The calls that take a syscalls counter add the fcntl() calls they made
+ * to it, for the transport statistics; it may be NULL.
+ */
+
+#ifndef __BUSLOCK_H__
+#define __BUSLOCK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUSLOCK_DIR         "/run/lock"
+
+// environment variable overriding BUSLOCK_DIR, also makes the emulated
+// transport take the lock
+#define BUSLOCK_DIR_ENV     "POWERCAPE_LOCK_DIR"
+
+// pause between looks while the bus is held or a higher priority waiter
+// is marked
+#define BUSLOCK_YIELD_US    200
+
+// longest an urgent request waits before going ahead without the lock
+#define BUSLOCK_URGENT_WAIT_MS  250
+
+typedef enum {
+    BUSLOCK_MONITOR,            // periodic sampling, may wait
+    BUSLOCK_NORMAL,             // commands
+    BUSLOCK_URGENT,             // watchdog refreshes
+    BUSLOCK_PRIORITIES
+} buslock_priority;
+
+
+int buslock_open(int i2c_bus);
+
+int buslock_acquire(int fd, buslock_priority priority, unsigned long *syscalls);
+
+void buslock_release(int fd, unsigned long *syscalls);
+
+void buslock_close(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,311 @@
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include "capeasync.h"
+
+
+static void run_request( cape_async *async, cape_async_req *req )
+{
+    switch ( req->op )
+    {
+        case CAPE_ASYNC_SNAPSHOT:
+        {
+            req->rc = cape_snapshot_r( async->cape, &req->regs );
+            break;
+        }
+
+        case CAPE_ASYNC_WRITE:
+        {
+            req->rc = cape_register_write_r( async->cape, req->reg, req->data );
+            break;
+        }
+
+        case CAPE_ASYNC_RTC:
+        {
+            req->rc = cape_snapshot_range_r( async->cape, &req->regs, REG_SECONDS_0, 4 );
+            if ( req->rc == 0 )
+            {
+                req->rtc = cape_snapshot_seconds( &req->regs );
+            }
+            break;
+        }
+
+        case CAPE_ASYNC_INA_SAMPLE:
+        {
+            req->rc = -1;
+            if ( async->ina != NULL &&
+                 ina_get_voltage( async->ina, &req->mv ) == 0 &&
+                 ina_get_current( async->ina, &req->ma ) == 0 )
+            {
+                req->rc = 0;
+            }
+            break;
+        }
+
+        default:
+        {
+            req->rc = -1;
+            break;
+        }
+    }
+}
+
+
+static void *io_thread( void *arg )
+{
+    cape_async *async = arg;
+    cape_async_req *req;
+    uint64_t one = 1;
+
+    pthread_mutex_lock( &async->lock );
+    while ( 1 )
+    {
+        while ( async->pending == NULL && !async->stopping )
+        {
+            pthread_cond_wait( &async->wake, &async->lock );
+        }
+        if ( async->pending == NULL )
+        {
+            break;
+        }
+
+        req = async->pending;
+        async->pending = req->next;
+        if ( async->pending == NULL )
+        {
+            async->pending_tail = NULL;
+        }
+        req->next = NULL;
+
+        // the bus transfer runs without the queue lock so callers never block
+        pthread_mutex_unlock( &async->lock );
+        run_request( async, req );
+        pthread_mutex_lock( &async->lock );
+
+        if ( async->done_tail != NULL )
+        {
+            async->done_tail->next = req;
+        }
+        else
+        {
+            async->done = req;
+        }
+        async->done_tail = req;
+
+        if ( write( async->eventfd, &one, sizeof( one ) ) != sizeof( one ) )
+        {
+            fprintf( stderr, "cape async: eventfd write failed: %s\n", strerror( errno ) );
+        }
+    }
+    pthread_mutex_unlock( &async->lock );
+
+    return NULL;
+}
+
+
+cape_async *cape_async_start( cape_t *cape, ina_t *ina )
+{
+    cape_async *async;
+
+    async = calloc( 1, sizeof( cape_async ) );
+    if ( async == NULL )
+    {
+        fprintf( stderr, "Out of memory allocating async context\n" );
+        return NULL;
+    }
+
+    async->cape = cape;
+    async->ina = ina;
+    async->eventfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if ( async->eventfd < 0 )
+    {
+        fprintf( stderr, "Error creating eventfd: %s\n", strerror( errno ) );
+        free( async );
+        return NULL;
+    }
+
+    pthread_mutex_init( &async->lock, NULL );
+    pthread_cond_init( &async->wake, NULL );
+
+    if ( pthread_create( &async->thread, NULL, io_thread, async ) != 0 )
+    {
+        fprintf( stderr, "Error starting cape I/O thread\n" );
+        close( async->eventfd );
+        pthread_cond_destroy( &async->wake );
+        pthread_mutex_destroy( &async->lock );
+        free( async );
+        return NULL;
+    }
+
+    return async;
+}
+
+
+// Finishes the queued requests, then frees everything not yet collected
+void cape_async_stop( cape_async *async )
+{
+    cape_async_req *req;
+
+    if ( async == NULL )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &async->lock );
+    async->stopping = 1;
+    pthread_cond_signal( &async->wake );
+    pthread_mutex_unlock( &async->lock );
+    pthread_join( async->thread, NULL );
+
+    while ( ( req = async->done ) != NULL )
+    {
+        async->done = req->next;
+        free( req );
+    }
+
+    close( async->eventfd );
+    pthread_cond_destroy( &async->wake );
+    pthread_mutex_destroy( &async->lock );
+    free( async );
+}
+
+
+int cape_async_fd( cape_async *async )
+{
+    return async->eventfd;
+}
+
+
+static int submit( cape_async *async, cape_async_op op, unsigned char reg, unsigned char data,
+                   cape_async_cb callback, void *arg )
+{
+    cape_async_req *req;
+
+    req = calloc( 1, sizeof( cape_async_req ) );
+    if ( req == NULL )
+    {
+        fprintf( stderr, "Out of memory queueing cape request\n" );
+        return -1;
+    }
+
+    req->op = op;
+    req->reg = reg;
+    req->data = data;
+    req->callback = callback;
+    req->arg = arg;
+
+    pthread_mutex_lock( &async->lock );
+    if ( async->pending_tail != NULL )
+    {
+        async->pending_tail->next = req;
+    }
+    else
+    {
+        async->pending = req;
+    }
+    async->pending_tail = req;
+    pthread_cond_signal( &async->wake );
+    pthread_mutex_unlock( &async->lock );
+
+    return 0;
+}
+
+
+int cape_async_snapshot( cape_async *async, cape_async_cb callback, void *arg )
+{
+    return submit( async, CAPE_ASYNC_SNAPSHOT, 0, 0, callback, arg );
+}
+
+
+int cape_async_write( cape_async *async, unsigned char reg, unsigned char data, cape_async_cb callback, void *arg )
+{
+    return submit( async, CAPE_ASYNC_WRITE, reg, data, callback, arg );
+}
+
+
+int cape_async_rtc( cape_async *async, cape_async_cb callback, void *arg )
+{
+    return submit( async, CAPE_ASYNC_RTC, 0, 0, callback, arg );
+}
+
+
+int cape_async_ina_sample( cape_async *async, cape_async_cb callback, void *arg )
+{
+    return submit( async, CAPE_ASYNC_INA_SAMPLE, 0, 0, callback, arg );
+}
+
+
+// Pop the oldest completed request, or NULL. The caller frees it.
+cape_async_req *cape_async_poll( cape_async *async )
+{
+    cape_async_req *req;
+    uint64_t count;
+
+    pthread_mutex_lock( &async->lock );
+    req = async->done;
+    if ( req != NULL )
+    {
+        async->done = req->next;
+        if ( async->done == NULL )
+        {
+            async->done_tail = NULL;
+            // drained, so a readable eventfd again means new completions
+            if ( read( async->eventfd, &count, sizeof( count ) ) < 0 && errno != EAGAIN )
+            {
+                fprintf( stderr, "cape async: eventfd read failed: %s\n", strerror( errno ) );
+            }
+        }
+        req->next = NULL;
+    }
+    pthread_mutex_unlock( &async->lock );
+
+    return req;
+}
+
+
+// Run the callbacks of all completed requests on the calling thread and
+// free them. Requests without a callback stay queued for cape_async_poll()
+// and do not signal the eventfd again, so a loop that only dispatches
+// does not wake for them.
+int cape_async_dispatch( cape_async *async )
+{
+    cape_async_req *ready = NULL, **ready_tail = &ready;
+    cape_async_req *req, **link;
+    uint64_t signalled;
+    int count = 0;
+
+    pthread_mutex_lock( &async->lock );
+    // reset under the lock, so only completions after this signal again
+    if ( read( async->eventfd, &signalled, sizeof( signalled ) ) < 0 && errno != EAGAIN )
+    {
+        fprintf( stderr, "cape async: eventfd read failed: %s\n", strerror( errno ) );
+    }
+
+    async->done_tail = NULL;
+    link = &async->done;
+    while ( ( req = *link ) != NULL )
+    {
+        if ( req->callback != NULL )
+        {
+            *link = req->next;
+            req->next = NULL;
+            *ready_tail = req;
+            ready_tail = &req->next;
+        }
+        else
+        {
+            async->done_tail = req;
+            link = &req->next;
+        }
+    }
+    pthread_mutex_unlock( &async->lock );
+
+    while ( ( req = ready ) != NULL )
+    {
+        ready = req->next;
+        req->callback( req, req->arg );
+        free( req );
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,84 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * capeasync.h
+ *
+ * Asynchronous cape and INA219 access for event loops. Operations are
+ * queued to a dedicated I/O thread; completion is signalled on an eventfd
+ * the caller can add to poll/epoll. Completed requests are then handed to
+ * their callbacks by cape_async_dispatch() on the caller's thread, or
+ * collected with cape_async_poll() when no callback was given. The eventfd
+ * signals each completion once: dispatch leaves requests without a
+ * callback queued but does not signal them again.
+ */
+
+#ifndef __CAPE_ASYNC_H__
+#define __CAPE_ASYNC_H__
+#include "powercape.h"
+#include "ina.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    CAPE_ASYNC_SNAPSHOT,            // full register snapshot into regs
+    CAPE_ASYNC_WRITE,               // write data to register reg
+    CAPE_ASYNC_RTC,                 // cape rtc into rtc
+    CAPE_ASYNC_INA_SAMPLE,          // voltage and current into mv, ma
+} cape_async_op;
+
+typedef struct _cape_async_req cape_async_req;
+
+typedef void (*cape_async_cb)(cape_async_req *req, void *arg);
+
+struct _cape_async_req {
+    cape_async_op op;
+    int rc;                         // 0 on success
+    unsigned char reg;
+    unsigned char data;
+    cape_registers regs;
+    time_t rtc;
+    float mv;
+    float ma;
+    cape_async_cb callback;
+    void *arg;
+    cape_async_req *next;
+};
+
+typedef struct _cape_async {
+    cape_t *cape;
+    ina_t *ina;
+    int eventfd;
+    int stopping;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    cape_async_req *pending;        // fifo of queued requests
+    cape_async_req *pending_tail;
+    cape_async_req *done;           // fifo of completed requests
+    cape_async_req *done_tail;
+} cape_async;
+
+
+cape_async *cape_async_start(cape_t *cape, ina_t *ina);
+
+void cape_async_stop(cape_async *async);
+
+int cape_async_fd(cape_async *async);
+
+int cape_async_snapshot(cape_async *async, cape_async_cb callback, void *arg);
+
+int cape_async_write(cape_async *async, unsigned char reg, unsigned char data, cape_async_cb callback, void *arg);
+
+int cape_async_rtc(cape_async *async, cape_async_cb callback, void *arg);
+
+int cape_async_ina_sample(cape_async *async, cape_async_cb callback, void *arg);
+
+int cape_async_dispatch(cape_async *async);
+
+cape_async_req *cape_async_poll(cape_async *async);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
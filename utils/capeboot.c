@@ -0,0 +1,101 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * capeboot.c
+ *
+ * Sets the system clock from the cape RTC as early in boot as possible,
+ * from an initramfs or the first systemd unit: one bus read, a check that
+ * the count is a clock, the stored drift correction if /var/lib is there
+ * yet, and settimeofday(). Built static so it runs before the root file
+ * system is up. Silent unless it fails. The bus lock is left alone: its
+ * directory may not exist yet and nothing else is on the bus this early.
+ *
+ *     capeboot [-n] [bus [address]]
+ *
+ * -n reads and checks but leaves the clock alone. Exits 0 when the clock
+ * was set, 1 when the cape could not be read and 2 when the RTC has
+ * never been set.
+ */
+
+
+#include <math.h>
+#include <sys/time.h>
+#include "powercape.h"
+#include "drift.h"
+
+// An RTC count before this has never been set; it is counting up from 0
+// since the cape last lost power
+#define CAPE_BOOT_VALID_AFTER   1577836800      // 2020-01-01
+
+
+int main( int argc, char *argv[] )
+{
+    int i2c_bus = CAPE_I2C_BUS;
+    int avr_address = AVR_ADDRESS;
+    int dry_run = 0;
+    char path[ 256 ];
+    cape_drift drift;
+    struct timeval tv;
+    time_t seconds;
+    transport_t *bus;
+    cape_t *cape;
+    double t;
+    int rc;
+
+    if ( argc > 1 && strcmp( argv[ 1 ], "-n" ) == 0 )
+    {
+        dry_run = 1;
+        argc--;
+        argv++;
+    }
+    if ( argc > 1 )
+    {
+        i2c_bus = strtol( argv[ 1 ], NULL, 0 );
+    }
+    if ( argc > 2 )
+    {
+        avr_address = strtol( argv[ 2 ], NULL, 0 );
+    }
+
+    bus = transport_open_unlocked( i2c_bus );
+    if ( bus == NULL )
+    {
+        return 1;
+    }
+    cape = cape_attach( bus, avr_address );
+    if ( cape == NULL )
+    {
+        transport_close( bus );
+        return 1;
+    }
+    rc = cape_boot_seconds_r( cape, &seconds );
+    cape_close_r( cape );
+    transport_close( bus );
+    if ( rc != 0 )
+    {
+        return 1;
+    }
+
+    if ( seconds < CAPE_BOOT_VALID_AFTER )
+    {
+        fprintf( stderr, "Cape RTC is not set, leaving the clock alone\n" );
+        return 2;
+    }
+
+    // the count was read somewhere within its second; the middle of it
+    // halves the worst error
+    t = seconds + 0.5;
+    cape_drift_path( path, sizeof( path ), i2c_bus, avr_address );
+    if ( cape_drift_load( path, &drift ) == 0 )
+    {
+        t = cape_drift_true_time( &drift, t );
+    }
+
+    tv.tv_sec = (time_t)floor( t );
+    tv.tv_usec = (long)( ( t - floor( t ) ) * 1000000 );
+    if ( !dry_run && settimeofday( &tv, NULL ) != 0 )
+    {
+        fprintf( stderr, "Error setting the clock: %s\n", strerror( errno ) );
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,297 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * capeconf.c
+ *
+ * Brings a cape in line with a configuration file. The register file is
+ * read in one burst, compared with the file, and only registers that
+ * differ are written, adjacent ones in a single transfer. Registers the
+ * firmware keeps in eeprom are left alone when already set.
+ *
+ * The file holds one "name = value" per line, '#' starts a comment:
+ *
+ *     charge_current = 2
+ *     charge_timer   = 6
+ *     start_enable   = 0x07
+ */
+
+
+#include <getopt.h>
+#include "powercape.h"
+
+typedef struct {
+    const char *name;
+    unsigned char reg;
+    int min;
+    int max;
+    int capability;             // lowest firmware level with the register
+} setting;
+
+// countdowns (wdt_*) are never at their configured value once running, so
+// naming one in the file re-arms it on every run
+static const setting settings[] = {
+    { "start_enable",   REG_START_ENABLE, 0,    START_ALL,  CAPABILITY_RTC },
+    { "wdt_reset",      REG_WDT_RESET,    0,    255,        CAPABILITY_WDT },
+    { "wdt_power",      REG_WDT_POWER,    0,    255,        CAPABILITY_WDT },
+    { "wdt_stop",       REG_WDT_STOP,     0,    255,        CAPABILITY_WDT },
+    { "wdt_start",      REG_WDT_START,    0,    255,        CAPABILITY_WDT },
+    { "i2c_address",    REG_I2C_ADDRESS,  0x08, 0x77,       CAPABILITY_ADDR },
+    { "charge_current", REG_I2C_ICHARGE,  CHARGE_RATE_ZERO, CHARGE_RATE_HIGH, CAPABILITY_CHARGE },
+    { "charge_timer",   REG_I2C_TCHARGE,  CHARGE_TIME_MIN,  CHARGE_TIME_MAX,  CAPABILITY_CHARGE },
+    { NULL,             0,                0,    0,          0 },
+};
+
+static int i2c_bus = CAPE_I2C_BUS;
+static int avr_address = AVR_ADDRESS;
+static int dry_run = 0;
+static int verbose = 0;
+static const char *config_file = NULL;
+
+
+void show_usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [OPTION] file\n", progname );
+    fprintf( stderr, "   Options:\n" );
+    fprintf( stderr, "      -h --help           Show usage.\n" );
+    fprintf( stderr, "      -n --dry-run        Show what would change without writing.\n" );
+    fprintf( stderr, "      -v --verbose        Also list settings that are already correct.\n" );
+    fprintf( stderr, "      -b --bus n          I2C bus (default %d).\n", CAPE_I2C_BUS );
+    fprintf( stderr, "      -a --address addr   Cape AVR address (default 0x%02X).\n", AVR_ADDRESS );
+    fprintf( stderr, "   Settings:\n" );
+    fprintf( stderr, "      start_enable wdt_reset wdt_power wdt_stop wdt_start\n" );
+    fprintf( stderr, "      i2c_address charge_current charge_timer\n" );
+    exit( 1 );
+}
+
+
+void parse( int argc, char *argv[] )
+{
+    while( 1 )
+    {
+        static const struct option lopts[] =
+        {
+            { "help",        0, 0, 'h' },
+            { "dry-run",     0, 0, 'n' },
+            { "verbose",     0, 0, 'v' },
+            { "bus",         1, 0, 'b' },
+            { "address",     1, 0, 'a' },
+            { NULL,          0, 0, 0 },
+        };
+        int c;
+
+        c = getopt_long( argc, argv, "hnvb:a:", lopts, NULL );
+
+        if( c == -1 )
+            break;
+
+        switch( c )
+        {
+            case 'n':
+            {
+                dry_run = 1;
+                break;
+            }
+
+            case 'v':
+            {
+                verbose = 1;
+                break;
+            }
+
+            case 'b':
+            {
+                i2c_bus = (int)strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            case 'a':
+            {
+                avr_address = (int)strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            default:
+            case 'h':
+            {
+                show_usage( argv[ 0 ] );
+                break;
+            }
+        }
+    }
+
+    if ( optind != argc - 1 )
+    {
+        show_usage( argv[ 0 ] );
+    }
+    config_file = argv[ optind ];
+}
+
+
+static const setting *find_setting( const char *name )
+{
+    int i;
+
+    for ( i = 0; settings[ i ].name != NULL; i++ )
+    {
+        if ( strcmp( settings[ i ].name, name ) == 0 )
+        {
+            return &settings[ i ];
+        }
+    }
+
+    return NULL;
+}
+
+
+// Fill desired from the file, returning the capability level it needs or
+// -1 on a bad file
+static int load_config( const char *path, cape_batch *desired )
+{
+    FILE *f;
+    char line[ 256 ];
+    int lineno = 0;
+    int needed = CAPABILITY_RTC;
+    int rc = 0;
+
+    f = fopen( path, "r" );
+    if ( f == NULL )
+    {
+        fprintf( stderr, "Error opening %s: %s\n", path, strerror( errno ) );
+        return -1;
+    }
+
+    cape_batch_init( desired );
+    while ( fgets( line, sizeof( line ), f ) != NULL )
+    {
+        char name[ 32 ], value[ 32 ], extra[ 2 ];
+        const setting *s;
+        char *end;
+        long n;
+        int fields;
+
+        lineno++;
+        if ( ( end = strchr( line, '#' ) ) != NULL )
+        {
+            *end = '\0';
+        }
+
+        fields = sscanf( line, " %31[a-z_0-9] = %31s %1s", name, value, extra );
+        if ( fields <= 0 )
+        {
+            continue;
+        }
+        if ( fields != 2 )
+        {
+            fprintf( stderr, "%s:%d: expected name = value\n", path, lineno );
+            rc = -1;
+            continue;
+        }
+
+        s = find_setting( name );
+        if ( s == NULL )
+        {
+            fprintf( stderr, "%s:%d: unknown setting %s\n", path, lineno, name );
+            rc = -1;
+            continue;
+        }
+
+        // out of range values would be clamped by the firmware and never
+        // compare equal, so reject them here
+        n = strtol( value, &end, 0 );
+        if ( *end != '\0' || n < s->min || n > s->max )
+        {
+            fprintf( stderr, "%s:%d: %s must be %d to %d\n", path, lineno, name, s->min, s->max );
+            rc = -1;
+            continue;
+        }
+
+        cape_batch_set( desired, s->reg, (unsigned char)n );
+        if ( s->capability > needed )
+        {
+            needed = s->capability;
+        }
+    }
+    fclose( f );
+
+    return rc < 0 ? rc : needed;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    cape_batch desired;
+    cape_registers current;
+    transport_stats before;
+    cape_t *cape;
+    int needed, capability, changes;
+    int i;
+
+    parse( argc, argv );
+
+    needed = load_config( config_file, &desired );
+    if ( needed < 0 )
+    {
+        exit( 1 );
+    }
+
+    cape = cape_open( i2c_bus, avr_address );
+    if ( cape == NULL )
+    {
+        exit( 1 );
+    }
+
+    // compare against the cape itself, not a cached copy
+    cape_cache_invalidate_r( cape );
+    if ( cape_snapshot_r( cape, &current ) != 0 )
+    {
+        fprintf( stderr, "Unable to read cape registers\n" );
+        exit( 1 );
+    }
+
+    capability = cape_snapshot_capability( &current );
+    if ( capability < needed )
+    {
+        fprintf( stderr, "Cape firmware capability %d does not support every setting (needs %d)\n",
+                 capability, needed );
+        exit( 1 );
+    }
+
+    for ( i = 0; settings[ i ].name != NULL; i++ )
+    {
+        unsigned char reg = settings[ i ].reg;
+
+        if ( !desired.pending[ reg ] )
+            continue;
+
+        if ( desired.value[ reg ] != current.reg[ reg ] )
+        {
+            printf( "%-16s %d -> %d\n", settings[ i ].name, current.reg[ reg ], desired.value[ reg ] );
+        }
+        else if ( verbose )
+        {
+            printf( "%-16s %d\n", settings[ i ].name, current.reg[ reg ] );
+        }
+    }
+
+    changes = cape_batch_diff( &desired, &current );
+    if ( changes == 0 || dry_run )
+    {
+        printf( "%d register%s to write\n", changes, changes == 1 ? "" : "s" );
+        cape_close_r( cape );
+        return 0;
+    }
+
+    before = cape->bus->stats;
+    if ( cape_batch_commit_r( cape, &desired ) != 0 )
+    {
+        fprintf( stderr, "Unable to write cape registers\n" );
+        cape_close_r( cape );
+        exit( 1 );
+    }
+
+    printf( "%d register%s written in %llu transfer%s\n",
+            changes, changes == 1 ? "" : "s",
+            (unsigned long long)( cape->bus->stats.transfers - before.transfers ),
+            cape->bus->stats.transfers - before.transfers == 1 ? "" : "s" );
+
+    cape_close_r( cape );
+    return 0;
+}
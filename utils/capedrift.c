@@ -0,0 +1,337 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * capedrift.c
+ *
+ * Measures how fast the cape RTC runs against the system clock, which
+ * should be kept by NTP while this runs: the RTC is read at its second
+ * ticks at intervals, a line is fit through its offset from the system
+ * clock, and the slope is stored as the cape's drift in ppm. power uses
+ * the stored drift when it sets the system time from the RTC and when it
+ * schedules a wake time.
+ */
+
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <signal.h>
+#include <math.h>
+#include <sys/timex.h>
+#include "powercape.h"
+#include "drift.h"
+
+// fewest samples and shortest span a rate is worth fitting from
+#define DRIFT_MIN_SAMPLES   3
+#define DRIFT_MIN_SPAN_SEC  60
+
+static int i2c_bus = CAPE_I2C_BUS;
+static int avr_address = AVR_ADDRESS;
+static int minutes = 60;
+static int interval = 30;
+static int show_only = 0;
+static int dry_run = 0;
+static const char *path = NULL;
+static volatile sig_atomic_t running = 1;
+
+
+void show_usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [OPTION]\n", progname );
+    fprintf( stderr, "   Options:\n" );
+    fprintf( stderr, "      -h --help            Show usage.\n" );
+    fprintf( stderr, "      -m --minutes n       Measure for n minutes (default 60); longer resolves\n" );
+    fprintf( stderr, "                           smaller drift, about 1 ppm per 5 minutes.\n" );
+    fprintf( stderr, "      -i --interval n      Sample every n seconds (default 30).\n" );
+    fprintf( stderr, "      -s --show            Show the stored drift and exit.\n" );
+    fprintf( stderr, "      -n --dry-run         Measure but do not store the result.\n" );
+    fprintf( stderr, "      -f --file path       Drift file (default %s/drift-<bus>-<address>).\n", CAPE_DRIFT_DIR );
+    fprintf( stderr, "      -b --bus n           I2C bus of the cape (default %d).\n", CAPE_I2C_BUS );
+    fprintf( stderr, "      -a --address n       I2C address of the cape (default 0x%02X).\n", AVR_ADDRESS );
+    exit( 1 );
+}
+
+
+void parse( int argc, char *argv[] )
+{
+    while( 1 )
+    {
+        static const struct option lopts[] =
+        {
+            { "help",        0, 0, 'h' },
+            { "minutes",     1, 0, 'm' },
+            { "interval",    1, 0, 'i' },
+            { "show",        0, 0, 's' },
+            { "dry-run",     0, 0, 'n' },
+            { "file",        1, 0, 'f' },
+            { "bus",         1, 0, 'b' },
+            { "address",     1, 0, 'a' },
+            { NULL,          0, 0, 0 },
+        };
+        int c;
+
+        c = getopt_long( argc, argv, "hm:i:snf:b:a:", lopts, NULL );
+
+        if( c == -1 )
+            break;
+
+        switch( c )
+        {
+            case 'm':
+            {
+                minutes = atoi( optarg );
+                if ( minutes < 1 )
+                {
+                    show_usage( argv[ 0 ] );
+                }
+                break;
+            }
+
+            case 'i':
+            {
+                interval = atoi( optarg );
+                if ( interval < 2 )
+                {
+                    show_usage( argv[ 0 ] );
+                }
+                break;
+            }
+
+            case 's':
+            {
+                show_only = 1;
+                break;
+            }
+
+            case 'n':
+            {
+                dry_run = 1;
+                break;
+            }
+
+            case 'f':
+            {
+                path = optarg;
+                break;
+            }
+
+            case 'b':
+            {
+                i2c_bus = strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            case 'a':
+            {
+                avr_address = strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            default:
+            case 'h':
+            {
+                show_usage( argv[ 0 ] );
+                break;
+            }
+        }
+    }
+}
+
+
+static void stop( int sig )
+{
+    (void)sig;
+    running = 0;
+}
+
+
+static double timespec_sec( const struct timespec *ts )
+{
+    return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+
+// A drift measured against an unsynchronized system clock is the system
+// clock's drift as much as the cape's
+static void check_ntp( void )
+{
+    struct timex tx;
+
+    memset( &tx, 0, sizeof( tx ) );
+    if ( adjtimex( &tx ) == TIME_ERROR || ( tx.status & STA_UNSYNC ) )
+    {
+        fprintf( stderr, "Warning: the system clock is not synchronized by NTP\n" );
+    }
+}
+
+
+static int show( const char *file )
+{
+    cape_drift drift;
+    struct timespec now;
+    double elapsed;
+
+    if ( cape_drift_load( file, &drift ) != 0 )
+    {
+        fprintf( stderr, "No drift stored in %s\n", file );
+        return 1;
+    }
+
+    clock_gettime( CLOCK_REALTIME, &now );
+    elapsed = timespec_sec( &now ) - drift.reference;
+    printf( "drift      %+.3f ppm (%+.2f s/day)\n", drift.ppm, drift.ppm * 86400e-6 );
+    printf( "offset     %+.3f s when the clock was set %.1f days ago\n", drift.offset, elapsed / 86400 );
+    printf( "expected   %+.3f s now\n", drift.offset + elapsed * drift.ppm * 1e-6 );
+    return 0;
+}
+
+
+// Fit offset = a + b * t by least squares, t relative to the first sample;
+// returns the rms residual
+static double fit( const double *t, const double *offset, int n, double *a, double *b )
+{
+    double st = 0, so = 0, stt = 0, sto = 0, rss = 0;
+    int i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        st += t[ i ];
+        so += offset[ i ];
+        stt += t[ i ] * t[ i ];
+        sto += t[ i ] * offset[ i ];
+    }
+
+    *b = ( n * sto - st * so ) / ( n * stt - st * st );
+    *a = ( so - *b * st ) / n;
+
+    for ( i = 0; i < n; i++ )
+    {
+        double r = offset[ i ] - ( *a + *b * t[ i ] );
+        rss += r * r;
+    }
+
+    return sqrt( rss / n );
+}
+
+
+static int measure( cape_t *cape, const char *file )
+{
+    int max = minutes * 60 / interval + 1;
+    double *t, *offset;
+    double start = 0, a, b, rms;
+    struct timespec next;
+    cape_drift drift;
+    int n = 0;
+    int rc = 1;
+
+    t = calloc( max, sizeof( double ) );
+    offset = calloc( max, sizeof( double ) );
+    if ( t == NULL || offset == NULL )
+    {
+        fprintf( stderr, "Out of memory\n" );
+        free( t );
+        free( offset );
+        return 1;
+    }
+
+    check_ntp();
+    printf( "Sampling every %d s for %d minutes, interrupt to stop early\n", interval, minutes );
+    printf( "%6s %10s %12s\n", "sample", "elapsed s", "offset ms" );
+
+    clock_gettime( CLOCK_MONOTONIC, &next );
+    while ( running && n < max )
+    {
+        struct timespec cape_ts, sys_ts;
+
+        // the cape time is counted from its tick, so both clocks are read
+        // together here
+        if ( cape_rtc_now_r( cape, &cape_ts ) != 0 )
+        {
+            break;
+        }
+        clock_gettime( CLOCK_REALTIME, &sys_ts );
+
+        if ( n == 0 )
+        {
+            start = timespec_sec( &sys_ts );
+        }
+        t[ n ] = timespec_sec( &sys_ts ) - start;
+        offset[ n ] = ( cape_ts.tv_sec - sys_ts.tv_sec ) + ( cape_ts.tv_nsec - sys_ts.tv_nsec ) / 1e9;
+        printf( "%6d %10.1f %+12.3f\n", n, t[ n ], offset[ n ] * 1000 );
+        fflush( stdout );
+        n++;
+
+        next.tv_sec += interval;
+        while ( running && n < max &&
+                clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL ) == EINTR )
+            ;
+    }
+
+    if ( n < DRIFT_MIN_SAMPLES || t[ n - 1 ] < DRIFT_MIN_SPAN_SEC )
+    {
+        fprintf( stderr, "Too few samples to fit a drift, need %d over %d s\n",
+                 DRIFT_MIN_SAMPLES, DRIFT_MIN_SPAN_SEC );
+        goto out;
+    }
+
+    rms = fit( t, offset, n, &a, &b );
+    drift.ppm = b * 1e6;
+    drift.reference = start + t[ n - 1 ];
+    drift.offset = a + b * t[ n - 1 ];
+
+    printf( "drift      %+.3f ppm (%+.2f s/day)\n", drift.ppm, drift.ppm * 86400e-6 );
+    printf( "residual   %.3f ms rms, resolves about %.2f ppm\n", rms * 1000, rms / t[ n - 1 ] * 1e6 );
+    printf( "offset     %+.3f ms now\n", drift.offset * 1000 );
+
+    rc = 0;
+    if ( !dry_run )
+    {
+        rc = cape_drift_save( file, &drift ) == 0 ? 0 : 1;
+        if ( rc == 0 )
+        {
+            printf( "Stored in %s\n", file );
+        }
+    }
+
+out:
+    free( t );
+    free( offset );
+    return rc;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    char file[ 256 ];
+    struct sigaction sa;
+    cape_t *cape;
+    int rc;
+
+    parse( argc, argv );
+
+    if ( path != NULL )
+    {
+        snprintf( file, sizeof( file ), "%s", path );
+    }
+    else
+    {
+        cape_drift_path( file, sizeof( file ), i2c_bus, avr_address );
+    }
+
+    if ( show_only )
+    {
+        return show( file );
+    }
+
+    memset( &sa, 0, sizeof( sa ) );
+    sa.sa_handler = stop;
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+
+    cape = cape_open( i2c_bus, avr_address );
+    if ( cape == NULL )
+    {
+        return 1;
+    }
+
+    rc = measure( cape, file );
+    cape_close_r( cape );
+    return rc;
+}
@@ -0,0 +1,399 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * capetrace.c
+ *
+ * Works with bus traces recorded through POWERCAPE_TRACE: prints them,
+ * replays them against the emulated cape, or compares the bus usage of
+ * two traces so a change that adds transactions to a command is caught.
+ */
+
+
+#include <getopt.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "transport.h"
+
+typedef enum {
+    OP_NONE,
+    OP_DUMP,
+    OP_REPLAY,
+    OP_COMPARE,
+} op_type;
+
+// bus usage of a whole trace
+typedef struct {
+    unsigned long transactions;
+    unsigned long messages;
+    unsigned long bytes;
+    unsigned long bus_bits;
+    unsigned long errors;
+    unsigned long per_address[ 128 ];
+} trace_summary;
+
+static op_type operation = OP_NONE;
+static int pace = 0;
+static int strict = 0;
+static double tolerance = 0.0;
+
+
+void show_usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s <mode> trace [trace]\n", progname );
+    fprintf( stderr, "   Mode (required):\n" );
+    fprintf( stderr, "      -h --help            Show usage.\n" );
+    fprintf( stderr, "      -d --dump            Print every transaction in trace.\n" );
+    fprintf( stderr, "      -r --replay          Replay trace against the emulated cape.\n" );
+    fprintf( stderr, "      -c --compare         Compare the bus usage of trace with a baseline trace,\n" );
+    fprintf( stderr, "                           given first; fails if it uses more of the bus.\n" );
+    fprintf( stderr, "   Options:\n" );
+    fprintf( stderr, "      -p --pace            Replay with the recorded timing.\n" );
+    fprintf( stderr, "      -s --strict          Replay fails when read data differs.\n" );
+    fprintf( stderr, "      -t --tolerance pct   Allowed growth when comparing (default 0).\n" );
+    exit( 1 );
+}
+
+
+void parse( int argc, char *argv[] )
+{
+    while( 1 )
+    {
+        static const struct option lopts[] =
+        {
+            { "help",        0, 0, 'h' },
+            { "dump",        0, 0, 'd' },
+            { "replay",      0, 0, 'r' },
+            { "compare",     0, 0, 'c' },
+            { "pace",        0, 0, 'p' },
+            { "strict",      0, 0, 's' },
+            { "tolerance",   1, 0, 't' },
+            { NULL,          0, 0, 0 },
+        };
+        int c;
+
+        c = getopt_long( argc, argv, "hdrcpst:", lopts, NULL );
+
+        if( c == -1 )
+            break;
+
+        switch( c )
+        {
+            case 'd':
+            {
+                operation = OP_DUMP;
+                break;
+            }
+
+            case 'r':
+            {
+                operation = OP_REPLAY;
+                break;
+            }
+
+            case 'c':
+            {
+                operation = OP_COMPARE;
+                break;
+            }
+
+            case 'p':
+            {
+                pace = 1;
+                break;
+            }
+
+            case 's':
+            {
+                strict = 1;
+                break;
+            }
+
+            case 't':
+            {
+                tolerance = atof( optarg );
+                break;
+            }
+
+            default:
+            case 'h':
+            {
+                show_usage( argv[ 0 ] );
+                break;
+            }
+        }
+    }
+
+    if ( operation == OP_NONE ||
+         argc - optind != ( operation == OP_COMPARE ? 2 : 1 ) )
+    {
+        show_usage( argv[ 0 ] );
+    }
+}
+
+
+static void print_transaction( unsigned long n, const trace_transaction *tr, uint64_t start )
+{
+    int i, j;
+
+    printf( "%6lu %10.3f ms", n, ( tr->time_us - start ) / 1000.0 );
+    for ( i = 0; i < tr->nmsgs; i++ )
+    {
+        const struct i2c_msg *m = &tr->msgs[ i ];
+
+        printf( "%s 0x%02X %c", i ? " |" : "", m->addr, ( m->flags & I2C_M_RD ) ? 'R' : 'W' );
+        for ( j = 0; j < m->len; j++ )
+        {
+            printf( " %02X", m->buf[ j ] );
+        }
+    }
+    if ( tr->err )
+    {
+        printf( "  (%s)", strerror( tr->err ) );
+    }
+    printf( "\n" );
+}
+
+
+static int dump( const char *path )
+{
+    trace_transaction tr;
+    unsigned long n = 0;
+    uint64_t start = 0;
+    FILE *f;
+    int bus, rc;
+
+    f = trace_open( path, &bus );
+    if ( f == NULL )
+    {
+        return 1;
+    }
+
+    printf( "bus %d\n", bus );
+    while ( ( rc = trace_read( f, &tr ) ) > 0 )
+    {
+        if ( n == 0 )
+            start = tr.time_us;
+        print_transaction( n++, &tr, start );
+    }
+    fclose( f );
+
+    if ( rc < 0 )
+    {
+        fprintf( stderr, "%s: damaged after %lu transactions\n", path, n );
+        return 1;
+    }
+    return 0;
+}
+
+
+// Send each recorded transaction to the emulated cape, once, as it was
+// sent (retries were recorded as transactions of their own)
+static int replay( const char *path )
+{
+    trace_transaction tr;
+    unsigned char expected[ TRACE_MAX_DATA ];
+    unsigned long n = 0, status_diffs = 0, data_diffs = 0;
+    uint64_t start = 0;
+    struct timespec t0;
+    transport_t *bus;
+    FILE *f;
+    int i2c_bus, rc, i;
+
+    f = trace_open( path, &i2c_bus );
+    if ( f == NULL )
+    {
+        return 1;
+    }
+
+    bus = transport_open_emulator( i2c_bus );
+    if ( bus == NULL )
+    {
+        fclose( f );
+        return 1;
+    }
+    transport_set_retry( bus, 0, 0 );
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+
+    while ( ( rc = trace_read( f, &tr ) ) > 0 )
+    {
+        int err;
+
+        if ( n == 0 )
+            start = tr.time_us;
+
+        if ( pace )
+        {
+            struct timespec now;
+            long long due_us, now_us;
+
+            clock_gettime( CLOCK_MONOTONIC, &now );
+            due_us = tr.time_us - start;
+            now_us = ( now.tv_sec - t0.tv_sec ) * 1000000LL + ( now.tv_nsec - t0.tv_nsec ) / 1000;
+            if ( due_us > now_us )
+            {
+                usleep( due_us - now_us );
+            }
+        }
+
+        memcpy( expected, tr.data, sizeof( expected ) );
+        err = transport_transfer( bus, tr.msgs, tr.nmsgs ) == 0 ? 0 : errno;
+
+        if ( ( err == 0 ) != ( tr.err == 0 ) )
+        {
+            printf( "%6lu status differs: recorded %s, replayed %s\n", n,
+                    tr.err ? strerror( tr.err ) : "ok", err ? strerror( err ) : "ok" );
+            status_diffs++;
+        }
+        else if ( err == 0 )
+        {
+            // only read messages can differ, writes were sent from the buffer
+            for ( i = 0; i < tr.nmsgs; i++ )
+            {
+                const struct i2c_msg *m = &tr.msgs[ i ];
+
+                if ( ( m->flags & I2C_M_RD ) &&
+                     memcmp( m->buf, &expected[ m->buf - tr.data ], m->len ) != 0 )
+                {
+                    if ( strict )
+                    {
+                        printf( "%6lu read data differs from 0x%02X\n", n, m->addr );
+                    }
+                    data_diffs++;
+                }
+            }
+        }
+        n++;
+    }
+    fclose( f );
+
+    printf( "%lu transactions replayed, %lu with a different status, %lu reads with different data\n",
+            n, status_diffs, data_diffs );
+    transport_print_stats( stdout, bus );
+    transport_close( bus );
+
+    if ( rc < 0 )
+    {
+        fprintf( stderr, "%s: damaged after %lu transactions\n", path, n );
+        return 1;
+    }
+    return status_diffs != 0 || ( strict && data_diffs != 0 );
+}
+
+
+static int summarize( const char *path, trace_summary *sum )
+{
+    trace_transaction tr;
+    FILE *f;
+    int rc, i;
+
+    memset( sum, 0, sizeof( trace_summary ) );
+    f = trace_open( path, NULL );
+    if ( f == NULL )
+    {
+        return -1;
+    }
+
+    while ( ( rc = trace_read( f, &tr ) ) > 0 )
+    {
+        sum->transactions++;
+        sum->messages += tr.nmsgs;
+        sum->bus_bits += transport_bus_bits( tr.msgs, tr.nmsgs );
+        sum->errors += tr.err != 0;
+        for ( i = 0; i < tr.nmsgs; i++ )
+        {
+            sum->bytes += tr.msgs[ i ].len;
+        }
+        if ( tr.nmsgs > 0 )
+        {
+            sum->per_address[ tr.msgs[ 0 ].addr & 0x7F ]++;
+        }
+    }
+    fclose( f );
+
+    if ( rc < 0 )
+    {
+        fprintf( stderr, "%s: damaged after %lu transactions\n", path, sum->transactions );
+    }
+    return rc;
+}
+
+
+static int grew( const char *what, unsigned long base, unsigned long now )
+{
+    int worse = now > base * ( 1.0 + tolerance / 100.0 );
+
+    printf( "%-14s %10lu %10lu %+9ld%s\n", what, base, now, (long)( now - base ), worse ? "  MORE" : "" );
+    return worse;
+}
+
+
+// Bus usage of path against baseline; only growth fails, so a baseline is
+// refreshed by hand when traffic is cut
+static int compare( const char *baseline, const char *path )
+{
+    trace_summary a, b;
+    int worse = 0;
+    int i;
+
+    if ( summarize( baseline, &a ) < 0 || summarize( path, &b ) < 0 )
+    {
+        return 2;
+    }
+
+    printf( "%-14s %10s %10s %9s\n", "", "baseline", "trace", "change" );
+    worse |= grew( "transactions", a.transactions, b.transactions );
+    worse |= grew( "messages", a.messages, b.messages );
+    worse |= grew( "bytes", a.bytes, b.bytes );
+    worse |= grew( "bus bits", a.bus_bits, b.bus_bits );
+    worse |= grew( "errors", a.errors, b.errors );
+    for ( i = 0; i < 128; i++ )
+    {
+        if ( a.per_address[ i ] || b.per_address[ i ] )
+        {
+            char what[ 16 ];
+
+            snprintf( what, sizeof( what ), "  to 0x%02X", i );
+            worse |= grew( what, a.per_address[ i ], b.per_address[ i ] );
+        }
+    }
+
+    printf( "%s\n", worse ? "bus usage grew" : "bus usage ok" );
+    return worse;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    int rc = 0;
+
+    parse( argc, argv );
+
+    switch ( operation )
+    {
+        case OP_DUMP:
+        {
+            rc = dump( argv[ optind ] );
+            break;
+        }
+
+        case OP_REPLAY:
+        {
+            rc = replay( argv[ optind ] );
+            break;
+        }
+
+        case OP_COMPARE:
+        {
+            rc = compare( argv[ optind ], argv[ optind + 1 ] );
+            break;
+        }
+
+        default:
+        case OP_NONE:
+        {
+            break;
+        }
+    }
+
+    return rc;
+}
@@ -0,0 +1,321 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * capewdt.c
+ *
+ * Keepalive service for the cape watchdogs. Arms REG_WDT_RESET and/or
+ * REG_WDT_POWER and reloads them from a timerfd, waking only once per
+ * refresh interval. Refreshes can be made conditional on a heartbeat
+ * file being recent and on a process being alive, so a wedged system is
+ * left for the cape to reset.
+ */
+
+
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "powercape.h"
+
+static int i2c_bus = CAPE_I2C_BUS;
+static int avr_address = AVR_ADDRESS;
+static int reset_seconds = 0;
+static int power_seconds = 0;
+static int interval = 0;
+static const char *heartbeat_file = NULL;
+static int heartbeat_age = 0;
+static const char *pid_file = NULL;
+static int keep_armed = 0;
+
+
+void show_usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [OPTION] \n", progname );
+    fprintf( stderr, "   Options:\n" );
+    fprintf( stderr, "      -h --help              Show usage.\n" );
+    fprintf( stderr, "      -r --reset n           Arm the reset watchdog for n seconds (1-255).\n" );
+    fprintf( stderr, "      -p --power n           Arm the power-cycle watchdog for n seconds (1-255).\n" );
+    fprintf( stderr, "      -i --interval n        Refresh every n seconds (default half the shortest timeout).\n" );
+    fprintf( stderr, "      -f --heartbeat file    Only refresh while file was modified recently.\n" );
+    fprintf( stderr, "      -a --heartbeat-age n   Maximum heartbeat age in seconds (default the interval).\n" );
+    fprintf( stderr, "      -P --pidfile file      Only refresh while the process in file is alive.\n" );
+    fprintf( stderr, "      -k --keep-armed        Leave the watchdogs armed on exit.\n" );
+    fprintf( stderr, "      -b --bus n             I2C bus (default %d).\n", CAPE_I2C_BUS );
+    fprintf( stderr, "      -A --address addr      Cape AVR address (default 0x%02X).\n", AVR_ADDRESS );
+    exit( 1 );
+}
+
+
+static int parse_seconds( const char *arg, char *progname )
+{
+    int n = atoi( arg );
+
+    if ( n < 1 || n > 255 )
+    {
+        show_usage( progname );
+    }
+
+    return n;
+}
+
+
+void parse( int argc, char *argv[] )
+{
+    while( 1 )
+    {
+        static const struct option lopts[] =
+        {
+            { "help",          0, 0, 'h' },
+            { "reset",         1, 0, 'r' },
+            { "power",         1, 0, 'p' },
+            { "interval",      1, 0, 'i' },
+            { "heartbeat",     1, 0, 'f' },
+            { "heartbeat-age", 1, 0, 'a' },
+            { "pidfile",       1, 0, 'P' },
+            { "keep-armed",    0, 0, 'k' },
+            { "bus",           1, 0, 'b' },
+            { "address",       1, 0, 'A' },
+            { NULL,            0, 0, 0 },
+        };
+        int c;
+
+        c = getopt_long( argc, argv, "hr:p:i:f:a:P:kb:A:", lopts, NULL );
+
+        if( c == -1 )
+            break;
+
+        switch( c )
+        {
+            case 'r':
+            {
+                reset_seconds = parse_seconds( optarg, argv[ 0 ] );
+                break;
+            }
+
+            case 'p':
+            {
+                power_seconds = parse_seconds( optarg, argv[ 0 ] );
+                break;
+            }
+
+            case 'i':
+            {
+                interval = parse_seconds( optarg, argv[ 0 ] );
+                break;
+            }
+
+            case 'f':
+            {
+                heartbeat_file = optarg;
+                break;
+            }
+
+            case 'a':
+            {
+                heartbeat_age = atoi( optarg );
+                break;
+            }
+
+            case 'P':
+            {
+                pid_file = optarg;
+                break;
+            }
+
+            case 'k':
+            {
+                keep_armed = 1;
+                break;
+            }
+
+            case 'b':
+            {
+                i2c_bus = (int)strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            case 'A':
+            {
+                avr_address = (int)strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            default:
+            case 'h':
+            {
+                show_usage( argv[ 0 ] );
+                break;
+            }
+        }
+    }
+
+    if ( reset_seconds == 0 && power_seconds == 0 )
+    {
+        fprintf( stderr, "Nothing to keep alive, use -r and/or -p\n" );
+        show_usage( argv[ 0 ] );
+    }
+}
+
+
+static int healthy( void )
+{
+    struct stat st;
+
+    if ( heartbeat_file != NULL )
+    {
+        if ( stat( heartbeat_file, &st ) != 0 || time( NULL ) - st.st_mtime > heartbeat_age )
+        {
+            return 0;
+        }
+    }
+
+    if ( pid_file != NULL )
+    {
+        FILE *f = fopen( pid_file, "r" );
+        int pid = 0;
+
+        if ( f == NULL )
+        {
+            return 0;
+        }
+        if ( fscanf( f, "%d", &pid ) != 1 )
+        {
+            pid = 0;
+        }
+        fclose( f );
+
+        if ( pid <= 0 || ( kill( pid, 0 ) != 0 && errno != EPERM ) )
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// Load the armed watchdogs with value, or their timeouts when value is -1.
+// REG_WDT_RESET and REG_WDT_POWER are adjacent, so either or both go out
+// as one write transaction.
+static int feed( cape_t *cape, int value )
+{
+    unsigned char data[ 2 ];
+
+    data[ 0 ] = value < 0 ? reset_seconds : value;
+    data[ 1 ] = value < 0 ? power_seconds : value;
+
+    if ( reset_seconds && power_seconds )
+    {
+        return cape_register_block_write_r( cape, REG_WDT_RESET, data, 2 );
+    }
+    if ( reset_seconds )
+    {
+        return cape_register_write_r( cape, REG_WDT_RESET, data[ 0 ] );
+    }
+    return cape_register_write_r( cape, REG_WDT_POWER, data[ 1 ] );
+}
+
+
+int main( int argc, char *argv[] )
+{
+    struct itimerspec period;
+    struct pollfd fds[ 2 ];
+    sigset_t mask;
+    cape_t *cape;
+    int shortest;
+    int running = 1;
+    int rc = 0;
+
+    parse( argc, argv );
+
+    shortest = reset_seconds == 0 ? power_seconds :
+               power_seconds == 0 ? reset_seconds :
+               reset_seconds < power_seconds ? reset_seconds : power_seconds;
+    if ( interval == 0 )
+    {
+        interval = shortest > 1 ? shortest / 2 : 1;
+    }
+    if ( interval >= shortest )
+    {
+        fprintf( stderr, "Warning: interval %d s is not shorter than the %d s timeout\n", interval, shortest );
+    }
+    if ( heartbeat_age == 0 )
+    {
+        heartbeat_age = interval;
+    }
+
+    cape = cape_open( i2c_bus, avr_address );
+    if ( cape == NULL )
+    {
+        exit( 1 );
+    }
+    // a refresh must not sit behind another program's sampling
+    transport_set_priority( cape->bus, BUSLOCK_URGENT );
+
+    // signals arrive on a descriptor so the timer is the only other wakeup
+    sigemptyset( &mask );
+    sigaddset( &mask, SIGINT );
+    sigaddset( &mask, SIGTERM );
+    sigprocmask( SIG_BLOCK, &mask, NULL );
+
+    fds[ 0 ].fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+    fds[ 0 ].events = POLLIN;
+    fds[ 1 ].fd = signalfd( -1, &mask, SFD_CLOEXEC );
+    fds[ 1 ].events = POLLIN;
+    if ( fds[ 0 ].fd < 0 || fds[ 1 ].fd < 0 )
+    {
+        fprintf( stderr, "Error creating timer: %s\n", strerror( errno ) );
+        exit( 1 );
+    }
+
+    period.it_interval.tv_sec = interval;
+    period.it_interval.tv_nsec = 0;
+    period.it_value = period.it_interval;
+    timerfd_settime( fds[ 0 ].fd, 0, &period, NULL );
+
+    // arm right away, even before the first health check passes
+    if ( feed( cape, -1 ) != 0 )
+    {
+        exit( 1 );
+    }
+
+    while ( running )
+    {
+        uint64_t expirations;
+
+        if ( poll( fds, 2, -1 ) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            fprintf( stderr, "poll failed: %s\n", strerror( errno ) );
+            rc = 1;
+            break;
+        }
+
+        if ( fds[ 1 ].revents & POLLIN )
+        {
+            running = 0;
+        }
+        else if ( fds[ 0 ].revents & POLLIN &&
+                  read( fds[ 0 ].fd, &expirations, sizeof( expirations ) ) == sizeof( expirations ) )
+        {
+            if ( !healthy() )
+            {
+                fprintf( stderr, "Health check failed, not refreshing watchdog\n" );
+            }
+            else if ( feed( cape, -1 ) != 0 )
+            {
+                // a failed transfer is retried at the next tick
+                fprintf( stderr, "Watchdog refresh failed\n" );
+            }
+        }
+    }
+
+    if ( !keep_armed )
+    {
+        feed( cape, 0 );
+    }
+
+    cape_close_r( cape );
+    return rc;
+}
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include "discover.h"
+
+typedef struct {
+    pthread_t thread;
+    int started;
+    int i2c_bus;
+    int first_address;
+    int last_address;
+    int count;
+    unsigned char address[ 128 ];
+    unsigned char capability[ 128 ];
+} bus_probe;
+
+
+// Buses with an i2c-dev node, or the emulated one
+static int list_buses( int *buses, int max )
+{
+    const char *backend = getenv( TRANSPORT_ENV );
+    struct dirent *entry;
+    DIR *dir;
+    int n = 0;
+
+    if ( backend != NULL && strcmp( backend, TRANSPORT_EMULATOR ) == 0 )
+    {
+        buses[ n++ ] = CAPE_I2C_BUS;
+        return n;
+    }
+
+    dir = opendir( "/dev" );
+    if ( dir == NULL )
+    {
+        fprintf( stderr, "Error reading /dev: %s\n", strerror( errno ) );
+        return 0;
+    }
+
+    while ( n < max && ( entry = readdir( dir ) ) != NULL )
+    {
+        char *end;
+        long bus;
+
+        if ( strncmp( entry->d_name, "i2c-", 4 ) != 0 )
+            continue;
+
+        bus = strtol( entry->d_name + 4, &end, 10 );
+        if ( end != entry->d_name + 4 && *end == '\0' )
+        {
+            buses[ n++ ] = bus;
+        }
+    }
+    closedir( dir );
+
+    return n;
+}
+
+
+// Per address, without retries: an address a kernel driver owns is left
+// alone, then a 1 byte read must be acked before the cape's register
+// pointer is written; a nack on the address byte costs nothing, and a read
+// does not change the outputs of a port expander the way a write would
+static void *probe_bus( void *arg )
+{
+    bus_probe *p = arg;
+    transport_t *bus;
+    int address;
+
+    bus = transport_open( p->i2c_bus );
+    if ( bus == NULL )
+    {
+        return NULL;
+    }
+    transport_set_retry( bus, 0, 0 );
+
+    for ( address = p->first_address; address <= p->last_address; address++ )
+    {
+        unsigned char reg = REG_EXTENDED;
+        unsigned char data[ 2 ];
+        struct i2c_msg probe = { .addr = address, .flags = I2C_M_RD, .len = 1, .buf = data };
+        struct i2c_msg msgs[ 2 ] = {
+            { .addr = address, .flags = 0, .len = 1, .buf = &reg },
+            { .addr = address, .flags = I2C_M_RD, .len = 2, .buf = data },
+        };
+
+        // I2C_SLAVE, unlike I2C_SLAVE_FORCE, fails with EBUSY for a driver's
+        if ( bus->handle >= 0 )
+        {
+            STAT_ADD( bus, syscalls, 1 );
+            if ( ioctl( bus->handle, I2C_SLAVE, address ) < 0 )
+            {
+                continue;
+            }
+        }
+
+        if ( transport_transfer( bus, &probe, 1 ) == 0 &&
+             transport_transfer( bus, msgs, 2 ) == 0 && data[ 0 ] == 0x69 )
+        {
+            p->address[ p->count ] = address;
+            p->capability[ p->count ] = data[ 1 ];
+            p->count++;
+        }
+    }
+
+    transport_close( bus );
+    return NULL;
+}
+
+
+// Capes found on all buses, each with a handle of its own, in bus and
+// address order; returns how many, at most max
+int cape_discover( cape_found *found, int max, int first_address, int last_address )
+{
+    bus_probe probes[ DISCOVER_MAX_BUSES ];
+    int buses[ DISCOVER_MAX_BUSES ];
+    int nbuses, i, j, k;
+    int n = 0;
+
+    nbuses = list_buses( buses, DISCOVER_MAX_BUSES );
+
+    // bus numbers come in directory order
+    for ( i = 1; i < nbuses; i++ )
+    {
+        for ( j = i; j > 0 && buses[ j - 1 ] > buses[ j ]; j-- )
+        {
+            k = buses[ j ];
+            buses[ j ] = buses[ j - 1 ];
+            buses[ j - 1 ] = k;
+        }
+    }
+
+    memset( probes, 0, sizeof( probes ) );
+    for ( i = 0; i < nbuses; i++ )
+    {
+        probes[ i ].i2c_bus = buses[ i ];
+        probes[ i ].first_address = first_address < 0 ? 0 : first_address;
+        probes[ i ].last_address = last_address > 127 ? 127 : last_address;
+        probes[ i ].started = pthread_create( &probes[ i ].thread, NULL, probe_bus, &probes[ i ] ) == 0;
+        if ( !probes[ i ].started )
+        {
+            // probe it here instead
+            probe_bus( &probes[ i ] );
+        }
+    }
+
+    for ( i = 0; i < nbuses; i++ )
+    {
+        if ( probes[ i ].started )
+        {
+            pthread_join( probes[ i ].thread, NULL );
+        }
+
+        for ( j = 0; j < probes[ i ].count && n < max; j++ )
+        {
+            found[ n ].cape = cape_open( probes[ i ].i2c_bus, probes[ i ].address[ j ] );
+            found[ n ].capability = probes[ i ].capability[ j ];
+            if ( found[ n ].cape != NULL )
+            {
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
+
+
+void cape_discover_free( cape_found *found, int count )
+{
+    int i;
+
+    for ( i = 0; i < count; i++ )
+    {
+        cape_close_r( found[ i ].cape );
+        found[ i ].cape = NULL;
+    }
+}
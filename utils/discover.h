@@ -0,0 +1,40 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * discover.h
+ *
+ * Finds PowerCapes on every i2c bus of the system. A cape can be moved to
+ * any address kept in its eeprom (CAPABILITY_ADDR), so each address of a
+ * range is asked for REG_EXTENDED and REG_CAPABILITY; the extended marker
+ * identifies a cape. Nothing is written to an address that a kernel driver
+ * owns or that does not ack a plain read first. Buses are probed by a thread each, at the same time;
+ * addresses on one bus can only be probed one after another.
+ */
+
+#ifndef __DISCOVER_H__
+#define __DISCOVER_H__
+#include "powercape.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 7 bit addresses outside the ranges reserved by the i2c specification
+#define DISCOVER_FIRST_ADDRESS  0x08
+#define DISCOVER_LAST_ADDRESS   0x77
+
+#define DISCOVER_MAX_BUSES      32
+
+typedef struct _cape_found {
+    cape_t *cape;               // open handle, closed by cape_discover_free()
+    int capability;
+} cape_found;
+
+
+int cape_discover(cape_found *found, int max, int first_address, int last_address);
+
+void cape_discover_free(cape_found *found, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "drift.h"
+
+
+void cape_drift_path( char *path, int size, int i2c_bus, int avr_address )
+{
+    snprintf( path, size, "%s/drift-%d-%02x", CAPE_DRIFT_DIR, i2c_bus, avr_address );
+}
+
+
+// 0 when loaded; a missing file is not reported, it just means no model
+int cape_drift_load( const char *path, cape_drift *drift )
+{
+    FILE *f;
+    char line[ 128 ];
+    int found = 0;
+
+    f = fopen( path, "r" );
+    if ( f == NULL )
+    {
+        if ( errno != ENOENT )
+        {
+            fprintf( stderr, "Error opening %s: %s\n", path, strerror( errno ) );
+        }
+        return -1;
+    }
+
+    memset( drift, 0, sizeof( cape_drift ) );
+    while ( fgets( line, sizeof( line ), f ) != NULL )
+    {
+        found += sscanf( line, "ppm %lf", &drift->ppm );
+        found += sscanf( line, "reference %lf", &drift->reference );
+        found += sscanf( line, "offset %lf", &drift->offset );
+    }
+    fclose( f );
+
+    if ( found != 3 )
+    {
+        fprintf( stderr, "%s is incomplete, ignoring it\n", path );
+        return -1;
+    }
+
+    return 0;
+}
+
+
+// Written to a temporary file and renamed, so a reader at boot never sees
+// half a model
+int cape_drift_save( const char *path, const cape_drift *drift )
+{
+    char tmp[ 256 ];
+    FILE *f;
+
+    mkdir( CAPE_DRIFT_DIR, 0755 );
+    snprintf( tmp, sizeof( tmp ), "%s.tmp", path );
+
+    f = fopen( tmp, "w" );
+    if ( f == NULL )
+    {
+        fprintf( stderr, "Error writing %s: %s\n", tmp, strerror( errno ) );
+        return -1;
+    }
+
+    fprintf( f, "# cape rtc drift, see capedrift\n" );
+    fprintf( f, "ppm %.4f\n", drift->ppm );
+    fprintf( f, "reference %.3f\n", drift->reference );
+    fprintf( f, "offset %.6f\n", drift->offset );
+
+    if ( fclose( f ) != 0 || rename( tmp, path ) != 0 )
+    {
+        fprintf( stderr, "Error writing %s: %s\n", path, strerror( errno ) );
+        return -1;
+    }
+
+    return 0;
+}
+
+
+// System time for a cape reading: the cape counts (1 + ppm/1e6) seconds
+// for each real one since the reference
+double cape_drift_true_time( const cape_drift *drift, double cape_time )
+{
+    double cape_reference = drift->reference + drift->offset;
+
+    return drift->reference + ( cape_time - cape_reference ) / ( 1.0 + drift->ppm * 1e-6 );
+}
+
+
+// Wake time to hand cape_wake_at_r() so the cape, reading rtc now and
+// counting down at its own rate, powers on at the real time when
+time_t cape_drift_wake_time( const cape_drift *drift, time_t when, time_t rtc )
+{
+    double now = cape_drift_true_time( drift, rtc );
+
+    return rtc + (time_t)floor( ( when - now ) * ( 1.0 + drift->ppm * 1e-6 ) + 0.5 );
+}
@@ -0,0 +1,41 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * drift.h
+ *
+ * Rate error of a cape RTC against the system clock, as measured by
+ * capedrift, and its use when reading the RTC back or counting down to a
+ * wake time. One file per cape, keyed by bus and address since the cape
+ * carries no serial number.
+ */
+
+#ifndef __DRIFT_H__
+#define __DRIFT_H__
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPE_DRIFT_DIR      "/var/lib/powercape"
+
+typedef struct _cape_drift {
+    double ppm;                 // positive when the cape runs fast
+    double reference;           // system time the offset was taken at
+    double offset;              // cape minus system seconds at reference
+} cape_drift;
+
+
+void cape_drift_path(char *path, int size, int i2c_bus, int avr_address);
+
+int cape_drift_load(const char *path, cape_drift *drift);
+
+int cape_drift_save(const char *path, const cape_drift *drift);
+
+double cape_drift_true_time(const cape_drift *drift, double cape_time);
+
+time_t cape_drift_wake_time(const cape_drift *drift, time_t when, time_t rtc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
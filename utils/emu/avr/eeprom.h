@@ -0,0 +1,12 @@
+/* Host stand-in for <avr/eeprom.h> backed by the emulator's eeprom image */
+
+#ifndef __EMU_AVR_EEPROM_H__
+#define __EMU_AVR_EEPROM_H__
+#include <stdint.h>
+
+uint8_t eeprom_read_byte( const uint8_t *addr );
+void eeprom_update_byte( uint8_t *addr, uint8_t value );
+
+#define eeprom_busy_wait()
+
+#endif
@@ -0,0 +1,13 @@
+/* Host stand-in for <avr/interrupt.h>; the emulator calls vectors directly */
+
+#ifndef __EMU_AVR_INTERRUPT_H__
+#define __EMU_AVR_INTERRUPT_H__
+
+#define ISR( vector, ... )  void vector( void )
+
+#define sei()
+#define cli()
+
+void TWI_vect( void );
+
+#endif
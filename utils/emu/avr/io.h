@@ -0,0 +1,53 @@
+/* Host stand-in for <avr/io.h>, just enough of the ATmega328P register
+ * set for the firmware's registers.c, twi_slave.c and eeprom.c to build
+ * into the emulated cape.
+ */
+
+#ifndef __EMU_AVR_IO_H__
+#define __EMU_AVR_IO_H__
+#include <stdint.h>
+
+extern volatile uint8_t PINB;
+extern volatile uint8_t PIND;
+extern volatile uint8_t OSCCAL;
+extern volatile uint8_t MCUSR;
+extern volatile uint8_t TWSR;
+extern volatile uint8_t TWDR;
+extern volatile uint8_t TWCR;
+extern volatile uint8_t TWAR;
+
+// TWCR bits
+#define TWIE    0
+#define TWEN    2
+#define TWWC    3
+#define TWSTO   4
+#define TWSTA   5
+#define TWEA    6
+#define TWINT   7
+
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+#define PB6     6
+#define PB7     7
+
+#define PC0     0
+#define PC1     1
+#define PC2     2
+#define PC3     3
+#define PC4     4
+#define PC5     5
+
+#define PD0     0
+#define PD1     1
+#define PD2     2
+#define PD3     3
+#define PD4     4
+#define PD5     5
+#define PD6     6
+#define PD7     7
+
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for <avr/pgmspace.h>; flash is ordinary memory here */
+
+#ifndef __EMU_AVR_PGMSPACE_H__
+#define __EMU_AVR_PGMSPACE_H__
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte( addr )   ( *(const uint8_t *)( addr ) )
+
+#endif
@@ -0,0 +1,409 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * emulator.c
+ *
+ * In-process emulated PowerCape bus. The AVR side runs the firmware's own
+ * registers.c, twi_slave.c and eeprom.c (built against the host shims in
+ * emu/avr) and is driven through ISR(TWI_vect) one bus event at a time,
+ * so register auto-increment, REG_SECONDS_* and REG_EXTENDED behave as on
+ * the board. An INA219 register set sits next to it at INA_ADDRESS.
+ *
+ * There is one emulated bus per process, whatever bus number is opened.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "transport.h"
+#include "ina.h"
+#include "emu/avr/io.h"
+#include "../avr/registers.h"
+#include "../avr/eeprom.h"
+#include "../avr/twi_slave.h"
+
+#define EMU_EEPROM_SIZE     64
+
+// TWI status codes the slave ISR acts on
+#define TW_SR_SLA_ACK       0x60
+#define TW_SR_DATA_ACK      0x80
+#define TW_SR_STOP          0xA0
+#define TW_ST_SLA_ACK       0xA8
+#define TW_ST_DATA_ACK      0xB8
+#define TW_ST_DATA_NACK     0xC0
+
+// firmware entry points, declared in registers.h for avr builds only
+void registers_init( void );
+void registers_set_mask( uint8_t index, uint8_t mask );
+uint8_t registers_get( uint8_t index );
+void registers_set( uint8_t index, uint8_t value );
+void TWI_vect( void );
+
+// firmware globals normally defined in main.c and board.c
+volatile uint32_t seconds;
+volatile uint8_t rebootflag;
+volatile uint8_t activity_watchdog;
+
+volatile uint8_t PINB = 0xFF;       // opto inactive
+volatile uint8_t PIND = 0xFF;       // button released
+volatile uint8_t OSCCAL = 0x80;
+volatile uint8_t MCUSR;
+volatile uint8_t TWSR;
+volatile uint8_t TWDR;
+volatile uint8_t TWCR;
+volatile uint8_t TWAR;
+
+static struct {
+    pthread_mutex_t lock;
+    int initialized;
+    uint8_t eeprom[ EMU_EEPROM_SIZE ];
+    long long next_tick_ns;         // CLOCK_MONOTONIC of the next rtc tick
+
+    uint16_t ina_regs[ 6 ];
+    uint8_t ina_pointer;
+    struct timespec ina_converted;  // when CNVR was last cleared
+} emu = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+// Board and eeprom hooks called by the firmware sources
+
+uint8_t eeprom_read_byte( const uint8_t *addr )
+{
+    return emu.eeprom[ (uintptr_t)addr % EMU_EEPROM_SIZE ];
+}
+
+
+void eeprom_update_byte( uint8_t *addr, uint8_t value )
+{
+    emu.eeprom[ (uintptr_t)addr % EMU_EEPROM_SIZE ] = value;
+}
+
+
+uint8_t board_pgood( void )
+{
+    registers_set_mask( REG_STATUS, STATUS_POWER_GOOD );
+    return 1;
+}
+
+
+void board_ce( uint8_t enable )
+{
+}
+
+
+void board_led_on( uint8_t led )
+{
+}
+
+
+void board_led_off( uint8_t led )
+{
+}
+
+
+void board_set_charge_current( uint8_t thirds )
+{
+}
+
+
+void board_set_charge_timer( uint8_t hours )
+{
+}
+
+
+static long long emu_now_ns( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+// The rtc phase follows the host's clock write, as with timer2 reset
+void board_rtc_restart( void )
+{
+    emu.next_tick_ns = emu_now_ns() + 1000000000;
+}
+
+
+// Mirrors watchdog_check() in avr/main.c for the powered-on state
+static void emu_watchdog_check( void )
+{
+    uint8_t i;
+
+    i = registers_get( REG_WDT_RESET );
+    if ( i != 0 )
+    {
+        registers_set( REG_WDT_RESET, --i );
+        if ( i == 0 )
+        {
+            fprintf( stderr, "emulated cape: reset watchdog expired\n" );
+            registers_set( REG_START_REASON, 0 );
+            registers_set( REG_WDT_POWER, 0 );
+            registers_set( REG_WDT_STOP, 0 );
+        }
+    }
+
+    i = registers_get( REG_WDT_POWER );
+    if ( i != 0 )
+    {
+        registers_set( REG_WDT_POWER, --i );
+        if ( i == 0 )
+        {
+            fprintf( stderr, "emulated cape: power-cycle watchdog expired\n" );
+            registers_set( REG_WDT_RESET, 0 );
+            registers_set( REG_WDT_STOP, 0 );
+        }
+    }
+
+    i = registers_get( REG_WDT_STOP );
+    if ( i != 0 )
+    {
+        registers_set( REG_WDT_STOP, --i );
+        if ( i == 0 )
+        {
+            fprintf( stderr, "emulated cape: power-down countdown expired\n" );
+        }
+    }
+}
+
+
+// Advance the rtc and watchdogs by the whole seconds elapsed since last call
+static void emu_tick( void )
+{
+    long long now = emu_now_ns();
+
+    while ( emu.next_tick_ns <= now )
+    {
+        emu.next_tick_ns += 1000000000;
+        seconds++;
+        emu_watchdog_check();
+    }
+}
+
+
+static void emu_init( void )
+{
+    struct timespec now;
+
+    memset( emu.eeprom, 0xFF, sizeof( emu.eeprom ) );
+    emu.eeprom[ (uintptr_t)EEPROM_BOARD ] = BOARD_TYPE_BONE;
+    emu.eeprom[ (uintptr_t)EEPROM_REVISION ] = 'A';
+    emu.eeprom[ (uintptr_t)EEPROM_STEPPING ] = '2';
+
+    registers_init();
+    registers_set( REG_MCUSR, 0 );
+    registers_set( REG_OSCCAL, OSCCAL );
+    registers_set_mask( REG_START_REASON, START_PWRGOOD );
+    twi_slave_init();
+
+    // the board's rtc starts at zero; start from wall time to be useful,
+    // ticking at whatever phase the emulator happened to start with
+    seconds = (uint32_t)time( NULL );
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    emu.next_tick_ns = emu_now_ns() + 1000000000;
+
+    emu.ina_regs[ CONFIG_REG ] = INA_CONFIG_DEFAULT;
+    emu.ina_converted = now;
+
+    emu.initialized = 1;
+}
+
+
+// One message to or from the AVR, fed to the firmware ISR byte by byte
+static int avr_message( struct i2c_msg *msg )
+{
+    int i;
+
+    if ( msg->flags & I2C_M_RD )
+    {
+        TWSR = TW_ST_SLA_ACK;
+        TWI_vect();
+        for ( i = 0; i < msg->len; i++ )
+        {
+            if ( i > 0 )
+            {
+                TWSR = TW_ST_DATA_ACK;
+                TWI_vect();
+            }
+            msg->buf[ i ] = TWDR;
+        }
+        TWSR = TW_ST_DATA_NACK;
+        TWI_vect();
+    }
+    else
+    {
+        TWSR = TW_SR_SLA_ACK;
+        TWI_vect();
+        for ( i = 0; i < msg->len; i++ )
+        {
+            TWDR = msg->buf[ i ];
+            TWSR = TW_SR_DATA_ACK;
+            TWI_vect();
+        }
+    }
+
+    // stop or repeated start
+    TWSR = TW_SR_STOP;
+    TWI_vect();
+
+    return 0;
+}
+
+
+static void ina_update( void )
+{
+    struct timespec now;
+    uint16_t config = emu.ina_regs[ CONFIG_REG ];
+    long period_us, elapsed_us;
+    double t, mv, ma;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    t = now.tv_sec + now.tv_nsec / 1e9;
+
+    // battery voltage drifting slowly, with some ripple on the load current
+    mv = 3900.0 + 40.0 * sin( t / 60.0 );
+    ma = 250.0 + 25.0 * sin( t * 7.0 );
+
+    emu.ina_regs[ SHUNT_REG ] = (uint16_t)(int16_t)( ma * 10.0 );
+    emu.ina_regs[ BUS_REG ] = ( ( (uint16_t)( mv / 4.0 ) ) << 3 ) |
+                                    ( emu.ina_regs[ BUS_REG ] & INA_BUS_CNVR );
+
+    // continuous shunt and bus mode sets CNVR once both conversions finish
+    period_us = ina_conversion_us( ( config >> 7 ) & 0x0F ) + ina_conversion_us( ( config >> 3 ) & 0x0F );
+    elapsed_us = ( now.tv_sec - emu.ina_converted.tv_sec ) * 1000000 +
+                 ( now.tv_nsec - emu.ina_converted.tv_nsec ) / 1000;
+    if ( ( config & 0x07 ) != 0 && elapsed_us >= period_us )
+    {
+        emu.ina_regs[ BUS_REG ] |= INA_BUS_CNVR;
+    }
+}
+
+
+static int ina_message( struct i2c_msg *msg )
+{
+    int i;
+
+    ina_update();
+
+    if ( msg->flags & I2C_M_RD )
+    {
+        uint16_t value = emu.ina_regs[ emu.ina_pointer ];
+
+        for ( i = 0; i < msg->len; i++ )
+        {
+            msg->buf[ i ] = ( i & 1 ) ? ( value & 0xFF ) : ( value >> 8 );
+        }
+
+        // reading the power register clears the conversion ready flag
+        if ( emu.ina_pointer == POWER_REG )
+        {
+            emu.ina_regs[ BUS_REG ] &= ~INA_BUS_CNVR;
+            clock_gettime( CLOCK_MONOTONIC, &emu.ina_converted );
+        }
+        return 0;
+    }
+
+    if ( msg->len == 0 || msg->buf[ 0 ] > CALIBRATION_REG )
+    {
+        return msg->len == 0 ? 0 : -1;
+    }
+
+    emu.ina_pointer = msg->buf[ 0 ];
+    if ( msg->len >= 3 )
+    {
+        uint16_t value = ( msg->buf[ 1 ] << 8 ) | msg->buf[ 2 ];
+
+        if ( emu.ina_pointer == CONFIG_REG )
+        {
+            if ( value & INA_CONFIG_RESET )
+            {
+                value = INA_CONFIG_DEFAULT;
+            }
+            emu.ina_regs[ BUS_REG ] &= ~INA_BUS_CNVR;
+            clock_gettime( CLOCK_MONOTONIC, &emu.ina_converted );
+            emu.ina_regs[ CONFIG_REG ] = value;
+        }
+        else if ( emu.ina_pointer == CALIBRATION_REG )
+        {
+            emu.ina_regs[ CALIBRATION_REG ] = value & 0xFFFE;
+        }
+    }
+
+    return 0;
+}
+
+
+static int emulator_transfer( transport_t *t, struct i2c_msg *msgs, int nmsgs )
+{
+    int rc = 0;
+    int i;
+
+    // account for the one I2C_RDWR ioctl the i2c-dev backend would issue
+    STAT_ADD( t, syscalls, 1 );
+
+    pthread_mutex_lock( &emu.lock );
+    if ( !emu.initialized )
+    {
+        emu_init();
+    }
+    emu_tick();
+
+    for ( i = 0; i < nmsgs && rc == 0; i++ )
+    {
+        // once in the bootloader the application no longer answers
+        if ( msgs[ i ].addr == ( TWAR >> 1 ) && !rebootflag )
+        {
+            rc = avr_message( &msgs[ i ] );
+        }
+        else if ( msgs[ i ].addr == INA_ADDRESS )
+        {
+            rc = ina_message( &msgs[ i ] );
+        }
+        else
+        {
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock( &emu.lock );
+
+    if ( rc != 0 )
+    {
+        errno = ENXIO;
+    }
+
+    return rc;
+}
+
+
+static void emulator_close( transport_t *t )
+{
+}
+
+
+static const transport_ops emulator_ops = {
+    .name = "emulator",
+    .transfer = emulator_transfer,
+    .close = emulator_close,
+};
+
+
+transport_t *transport_open_emulator( int i2c_bus )
+{
+    transport_t *t;
+
+    t = calloc( 1, sizeof( transport_t ) );
+    if ( t == NULL )
+    {
+        fprintf( stderr, "Out of memory allocating transport\n" );
+        return NULL;
+    }
+
+    transport_init( t, &emulator_ops, i2c_bus );
+    t->handle = -1;
+    return t;
+}
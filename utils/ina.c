@@ -0,0 +1,266 @@
+#include "ina.h"
+
+
+static int i2c_write( ina_t *ina, void *buf, int len )
+{
+    int rc = 0;
+    struct i2c_msg msg;
+    ina->status = INA_OK;
+
+    msg.addr = ina->address;
+    msg.flags = 0;
+    msg.len = len;
+    msg.buf = buf;
+
+    if ( transport_transfer( ina->bus, &msg, 1 ) != 0 )
+    {
+        fprintf( stderr, "I2C write failed: %s\n", strerror( errno ) );
+        rc = -1;
+        ina->status = INA_ERROR;
+    }
+    
+    return rc;
+}
+
+
+static int i2c_write_read( ina_t *ina, void *wbuf, int wlen, void *rbuf, int rlen )
+{
+    int rc = 0;
+    struct i2c_msg msgs[ 2 ];
+    ina->status = INA_OK;
+
+    // pointer write and data read joined by a repeated start
+    msgs[ 0 ].addr = ina->address;
+    msgs[ 0 ].flags = 0;
+    msgs[ 0 ].len = wlen;
+    msgs[ 0 ].buf = wbuf;
+    msgs[ 1 ].addr = ina->address;
+    msgs[ 1 ].flags = I2C_M_RD;
+    msgs[ 1 ].len = rlen;
+    msgs[ 1 ].buf = rbuf;
+
+    if ( transport_transfer( ina->bus, msgs, 2 ) != 0 )
+    {
+        fprintf( stderr, "I2C transfer failed: %s\n", strerror( errno ) );
+        rc = -1;
+        ina->status = INA_ERROR;
+    }
+
+    return rc;
+}
+
+
+ina_t *ina_attach( transport_t *bus, int ina_address )
+{
+    ina_t *ina;
+
+    ina = calloc( 1, sizeof( ina_t ) );
+    if ( ina == NULL )
+    {
+        fprintf( stderr, "Out of memory allocating ina219 handle\n" );
+        return NULL;
+    }
+
+    ina->i2c_bus = bus->i2c_bus;
+    ina->address = ina_address;
+    ina->bus = bus;
+    ina->status = INA_OK;
+    pthread_mutex_init( &ina->lock, NULL );
+
+    return ina;
+}
+
+
+ina_t *ina_open( int i2c_bus, int ina_address )
+{
+    ina_t *ina;
+    transport_t *bus;
+
+    bus = transport_open( i2c_bus );
+    if ( bus == NULL )
+    {
+        return NULL;
+    }
+
+    ina = ina_attach( bus, ina_address );
+    if ( ina == NULL )
+    {
+        transport_close( bus );
+        return NULL;
+    }
+
+    ina->owns_bus = 1;
+    return ina;
+}
+
+
+int ina_close( ina_t *ina )
+{
+    if ( ina == NULL )
+    {
+        return 0;
+    }
+
+    if ( ina->owns_bus )
+    {
+        transport_close( ina->bus );
+    }
+    pthread_mutex_destroy( &ina->lock );
+    free( ina );
+
+    return 0;
+}
+
+
+int ina_register_read( ina_t *ina, unsigned char reg, unsigned short *data )
+{
+    int rc = -1;
+    unsigned char bite[ 4 ];
+    
+    pthread_mutex_lock( &ina->lock );
+    if ( i2c_write_read( ina, &reg, 1, bite, 2 ) == 0 )
+    {
+        *data = ( bite[ 0 ] << 8 ) | bite[ 1 ];
+        rc = 0;
+    }
+    pthread_mutex_unlock( &ina->lock );
+    
+    return rc;
+}
+
+
+int ina_register_write( ina_t *ina, unsigned char reg, unsigned short data )
+{
+    int rc = -1;
+    unsigned char bite[ 4 ];
+    
+    bite[ 0 ] = reg;
+    bite[ 1 ] = ( data >> 8 ) & 0xFF;
+    bite[ 2 ] = ( data & 0xFF );
+
+    pthread_mutex_lock( &ina->lock );
+    if ( i2c_write( ina, bite, 3 ) == 0 )
+    {
+        rc = 0;
+    }
+    pthread_mutex_unlock( &ina->lock );
+    
+    return rc;
+}
+
+
+int ina_get_voltage( ina_t *ina, float *mv )
+{
+    short bus;
+
+    if ( ina_register_read( ina, BUS_REG, (unsigned short*)&bus ) != 0 )
+    {
+        return -1;
+    }
+
+    *mv = ( float )( ( bus & 0xFFF8 ) >> 1 );
+    return 0;
+}
+
+
+int ina_get_current( ina_t *ina, float *ma )
+{
+    short shunt;
+
+    if ( ina_register_read( ina, SHUNT_REG, (unsigned short*)&shunt ) != 0 )
+    {
+        return -1;
+    }
+
+    *ma = (float)shunt / 10;
+    return 0;
+}
+
+
+// 4 bit ADC setting for a resolution of 9 to 12 bits, or for 2 to 128
+// samples averaged at 12 bits; -1 for anything else
+int ina_adc_setting( int bits, int average )
+{
+    int adc = 0x08;
+
+    if ( average == 1 )
+    {
+        return ( bits >= 9 && bits <= 12 ) ? bits - 9 : -1;
+    }
+
+    if ( bits != 12 || average < 2 || average > 128 || ( average & ( average - 1 ) ) )
+    {
+        return -1;
+    }
+
+    while ( average > 1 )
+    {
+        average >>= 1;
+        adc++;
+    }
+    return adc;
+}
+
+
+// Microseconds the datasheet gives one conversion at an ADC setting
+long ina_conversion_us( int adc )
+{
+    static const long single[] = { 84, 148, 276, 532 };
+
+    if ( adc & 0x08 )
+    {
+        adc &= 0x07;
+        return adc == 0 ? 532 : 532L << adc;
+    }
+
+    return single[ adc & 0x03 ];
+}
+
+
+// Both ADCs at one setting, converting continuously; the range and gain
+// are left as they were. previous, if given, gets the old CONFIG_REG.
+int ina_configure( ina_t *ina, int adc, unsigned short *previous )
+{
+    unsigned short config;
+
+    if ( ina_register_read( ina, CONFIG_REG, &config ) != 0 )
+    {
+        return -1;
+    }
+
+    if ( previous != NULL )
+    {
+        *previous = config;
+    }
+
+    config = ( config & INA_CONFIG_RANGE ) | ( adc << INA_CONFIG_BADC ) | ( adc << INA_CONFIG_SADC ) |
+             INA_MODE_CONTINUOUS;
+    return ina_register_write( ina, CONFIG_REG, config );
+}
+
+
+// 1 with the raw registers of a finished conversion, 0 while the next is
+// still running, -1 on a bus error. Reading POWER_REG clears CNVR, so each
+// conversion is returned once.
+int ina_read_conversion( ina_t *ina, unsigned short *bus, short *shunt )
+{
+    unsigned short power;
+
+    if ( ina_register_read( ina, BUS_REG, bus ) != 0 )
+    {
+        return -1;
+    }
+
+    if ( !( *bus & INA_BUS_CNVR ) )
+    {
+        return 0;
+    }
+
+    if ( ina_register_read( ina, SHUNT_REG, (unsigned short*)shunt ) != 0 ||
+         ina_register_read( ina, POWER_REG, &power ) != 0 )
+    {
+        return -1;
+    }
+
+    return 1;
+}
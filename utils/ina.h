@@ -0,0 +1,109 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * ina.h
+ */
+
+#ifndef __INA_H__
+#define __INA_H__
+#include <stdint.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CONFIG_REG          0
+#define SHUNT_REG           1
+#define BUS_REG             2
+#define POWER_REG           3
+#define CURRENT_REG         4
+#define CALIBRATION_REG     5
+
+// CONFIG_REG fields
+#define INA_CONFIG_RESET    0x8000
+#define INA_CONFIG_DEFAULT  0x399F      // power on: 32 V, /8 gain, 12 bit, continuous
+#define INA_CONFIG_RANGE    0x3800      // bus range and shunt gain
+#define INA_CONFIG_BADC     7           // bus ADC setting shift
+#define INA_CONFIG_SADC     3           // shunt ADC setting shift
+#define INA_MODE_CONTINUOUS 0x0007      // shunt and bus, continuous
+
+// BUS_REG flags below the voltage
+#define INA_BUS_CNVR        0x0002      // conversion ready, cleared by reading POWER_REG
+#define INA_BUS_OVF         0x0001      // math overflow
+
+#define INA_I2C_BUS         0x01
+#define INA_ADDRESS         0x40
+
+// status codes
+#define INA_INIT            0x00
+#define INA_OK              0x01
+#define INA_FAIL            0x02
+#define INA_ERROR           0x03
+
+// ina219 --stream output: this header, then a sample per conversion, all
+// in host byte order
+#define INA_STREAM_MAGIC    0x53414E49  // "INAS"
+#define INA_STREAM_VERSION  1
+
+struct ina_stream_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t config;                // CONFIG_REG while streaming
+    int64_t start_ns;               // CLOCK_REALTIME of the first sample's t_us 0
+};
+
+struct ina_stream_sample {
+    uint32_t t_us;                  // since start_ns, wrapping after 71 minutes
+    int16_t shunt;                  // SHUNT_REG, 10 uV per count
+    uint16_t bus;                   // BUS_REG, 4 mV per count from bit 3
+};
+
+// structure to hold data fields needed by ina219 routines, one per chip
+typedef struct _ina {
+    int i2c_bus;
+    int address;
+    transport_t *bus;
+    int owns_bus;               // bus is closed with the handle
+    int status;
+    pthread_mutex_t lock;
+} ina_t;
+
+
+ina_t *ina_open(int i2c_bus, int ina_address);
+
+ina_t *ina_attach(transport_t *bus, int ina_address);
+
+int ina_close(ina_t *ina);
+
+int ina_register_read(ina_t *ina, unsigned char reg, unsigned short *data);
+
+int ina_register_write(ina_t *ina, unsigned char reg, unsigned short data);
+
+int ina_get_voltage(ina_t *ina, float *mv);
+
+int ina_get_current(ina_t *ina, float *ma);
+
+int ina_adc_setting(int bits, int average);
+
+long ina_conversion_us(int adc);
+
+int ina_configure(ina_t *ina, int adc, unsigned short *previous);
+
+int ina_read_conversion(ina_t *ina, unsigned short *bus, short *shunt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
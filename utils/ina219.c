@@ -6,27 +6,23 @@
 #include <string.h>
 #include <time.h>
 #include <getopt.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <linux/i2c-dev.h>
-
-#define CONFIG_REG          0
-#define SHUNT_REG           1
-#define BUS_REG             2
-#define POWER_REG           3
-#define CURRENT_REG         4
-#define CALIBRATION_REG     5
+#include "ina.h"
 
 #define AVR_ADDRESS         0x21
-#define INA_ADDRESS         0x40
 
 typedef enum {
     OP_DUMP,
     OP_VOLTAGE,
     OP_CURRENT,
     OP_MONITOR,
+    OP_STREAM,
+    OP_DECODE,
     OP_NONE
 } op_type;
 
@@ -35,8 +31,13 @@ op_type operation = OP_DUMP;
 int interval = 60;
 int i2c_bus = 1;
 int i2c_address = INA_ADDRESS;
-int handle;
+ina_t *ina;
 int whole_numbers = 0;
+int show_stats = 0;
+int resolution = 12;
+int average = 1;
+long samples = 0;
+volatile sig_atomic_t running = 1;
 
 
 void msleep( int msecs )
@@ -45,71 +46,6 @@ void msleep( int msecs )
 }
 
 
-int i2c_read( void *buf, int len )
-{
-    int rc = 0;
-
-    if ( read( handle, buf, len ) != len )
-    {
-        printf( "I2C read failed: %s\n", strerror( errno ) );
-        rc = -1;
-    }
-
-    return rc;
-}
-
-
-int i2c_write( void *buf, int len )
-{
-    int rc = 0;
-    
-    if ( write( handle, buf, len ) != len ) 
-    {
-        printf( "I2C write failed: %s\n", strerror( errno ) );
-        rc = -1;
-    }
-    
-    return rc;
-}
-
-
-int register_read( unsigned char reg, unsigned short *data )
-{
-    int rc = -1;
-    unsigned char bite[ 4 ];
-    
-    bite[ 0 ] = reg;
-    if ( i2c_write( bite, 1 ) == 0 )
-    {
-        if ( i2c_read( bite, 2 ) == 0 )
-        {
-            *data = ( bite[ 0 ] << 8 ) | bite[ 1 ];
-            rc = 0;
-        }
-    }
-    
-    return rc;
-}
-
-
-int register_write( unsigned char reg, unsigned short data )
-{
-    int rc = -1;
-    unsigned char bite[ 4 ];
-    
-    bite[ 0 ] = reg;
-    bite[ 1 ] = ( data >> 8 ) & 0xFF;
-    bite[ 2 ] = ( data & 0xFF );
-
-    if ( i2c_write( bite, 3 ) == 0 )
-    {
-        rc = 0;
-    }
-    
-    return rc;
-}
-
-
 void show_usage( char *progname )
 {
     fprintf( stderr, "Usage: %s <mode> \n", progname );
@@ -121,6 +57,14 @@ void show_usage( char *progname )
     fprintf( stderr, "      -c --current        Show battery current in mA.\n" );
     fprintf( stderr, "      -a --address <addr> Override I2C address of INA219 from default of 0x%02X.\n", i2c_address );
     fprintf( stderr, "      -b --bus <i2c bus>  Override I2C bus from default of %d.\n", i2c_bus );
+    fprintf( stderr, "      -s --stream         Write every conversion to stdout as a binary stream\n" );
+    fprintf( stderr, "                          (see ina.h) until interrupted.\n" );
+    fprintf( stderr, "      -R --resolution n   ADC bits for --stream, 9 to 12 (default 12).\n" );
+    fprintf( stderr, "      -A --average n      Samples averaged per conversion for --stream, 1 to 128\n" );
+    fprintf( stderr, "                          in powers of 2 at 12 bits (default 1).\n" );
+    fprintf( stderr, "      -n --samples n      Stop --stream after n conversions.\n" );
+    fprintf( stderr, "      -d --decode         Print a --stream read from stdin as ms, mV and mA.\n" );
+    fprintf( stderr, "      -S --stats          Print bus statistics to stderr on exit.\n" );
     exit( 1 );
 }
 
@@ -131,18 +75,24 @@ void parse( int argc, char *argv[] )
     {
         static const struct option lopts[] =
         {
-            { "address",    0, 0, 'a' },
-            { "bus",        0, 0, 'b' },
+            { "address",    1, 0, 'a' },
+            { "average",    1, 0, 'A' },
+            { "bus",        1, 0, 'b' },
             { "current",    0, 0, 'c' },
+            { "decode",     0, 0, 'd' },
             { "help",       0, 0, 'h' },
-            { "interval",   0, 0, 'i' },
+            { "interval",   1, 0, 'i' },
+            { "samples",    1, 0, 'n' },
+            { "resolution", 1, 0, 'R' },
+            { "stream",     0, 0, 's' },
+            { "stats",      0, 0, 'S' },
             { "voltage",    0, 0, 'v' },
             { "whole",      0, 0, 'w' },
             { NULL,         0, 0, 0 },
         };
         int c;
 
-        c = getopt_long( argc, argv, "a:b:chi:vw", lopts, NULL );
+        c = getopt_long( argc, argv, "a:A:b:cdhi:n:R:svwS", lopts, NULL );
 
         if( c == -1 )
             break;
@@ -210,36 +160,66 @@ void parse( int argc, char *argv[] )
                 whole_numbers = 1;
                 break;
             }
+
+            case 'S':
+            {
+                show_stats = 1;
+                break;
+            }
+
+            case 's':
+            {
+                operation = OP_STREAM;
+                break;
+            }
+
+            case 'd':
+            {
+                operation = OP_DECODE;
+                break;
+            }
+
+            case 'R':
+            {
+                resolution = atoi( optarg );
+                break;
+            }
+
+            case 'A':
+            {
+                average = atoi( optarg );
+                break;
+            }
+
+            case 'n':
+            {
+                samples = atol( optarg );
+                if ( samples <= 0 )
+                {
+                    show_usage( argv[ 0 ] );
+                }
+                break;
+            }
         }
     }
+
+    if ( ina_adc_setting( resolution, average ) < 0 )
+    {
+        fprintf( stderr, "No ADC setting for %d bits averaging %d samples\n", resolution, average );
+        exit( 1 );
+    }
 }
 
 
 int get_voltage( float *mv )
 {
-    short bus;
-
-    if ( register_read( BUS_REG, (unsigned short*)&bus ) != 0 )
-    {
-        return -1;
-    }
-
-    *mv = ( float )( ( bus & 0xFFF8 ) >> 1 );
-    return 0;
+    return ina_get_voltage( ina, mv );
 }
 
 
 int get_current( float *ma )
 {
-    short shunt;
-
-    if ( register_read( SHUNT_REG, &shunt ) != 0 )
-    {
-        return -1;
-    }
-
-    *ma = (float)shunt / 10;
-    return 0;
+    return ina_get_current( ina, ma );
 }
 
 
@@ -298,12 +278,23 @@ void show_voltage_current( void )
 }
 
 
+void on_signal( int sig )
+{
+    running = 0;
+}
+
+
 void monitor( void )
 {
     struct tm *tmptr;
     time_t seconds;
 
-    while ( 1 )
+    // stop cleanly on ^C so the statistics still get printed
+    signal( SIGINT, on_signal );
+    signal( SIGTERM, on_signal );
+    transport_set_priority( ina->bus, BUSLOCK_MONITOR );
+
+    while ( running )
     {
         seconds = time( NULL );
         tmptr = localtime( &seconds );
@@ -314,23 +305,164 @@ void monitor( void )
 }
 
 
+static long elapsed_us( const struct timespec *since, const struct timespec *now )
+{
+    return ( now->tv_sec - since->tv_sec ) * 1000000 + ( now->tv_nsec - since->tv_nsec ) / 1000;
+}
+
+
+// Every conversion as the chip finishes it. The reads for one conversion
+// take a few hundred us at 400 kHz, so between conversions the bus is left
+// alone until one is nearly due. At 100 kHz the three reads take longer
+// than a 12 bit conversion pair and some conversions are skipped; the
+// gaps count them. 0 when the stream ended as asked, 1 when it was cut
+// short or never started.
+int stream( void )
+{
+    struct ina_stream_header header;
+    struct ina_stream_sample sample;
+    struct timespec start, poll, next;
+    unsigned short config, bus;
+    short shunt;
+    int adc = ina_adc_setting( resolution, average );
+    long period_us = 2 * ina_conversion_us( adc );
+    long count = 0, gaps = 0, last_us = -1, t_us;
+    int failed = 0;
+    int rc = 0;
+
+    if ( isatty( STDOUT_FILENO ) )
+    {
+        fprintf( stderr, "Not writing a binary stream to a terminal\n" );
+        return 1;
+    }
+
+    signal( SIGINT, on_signal );
+    signal( SIGTERM, on_signal );
+    transport_set_priority( ina->bus, BUSLOCK_MONITOR );
+
+    if ( ina_configure( ina, adc, &config ) != 0 ||
+         ina_register_read( ina, CONFIG_REG, &header.config ) != 0 )
+    {
+        fprintf( stderr, "Error configuring the INA219\n" );
+        return 1;
+    }
+
+    clock_gettime( CLOCK_REALTIME, &start );
+    header.magic = INA_STREAM_MAGIC;
+    header.version = INA_STREAM_VERSION;
+    header.start_ns = (int64_t)start.tv_sec * 1000000000 + start.tv_nsec;
+    fwrite( &header, sizeof( header ), 1, stdout );
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    while ( running && ( samples == 0 || count < samples ) )
+    {
+        clock_gettime( CLOCK_MONOTONIC, &poll );
+        rc = ina_read_conversion( ina, &bus, &shunt );
+        if ( rc < 0 )
+        {
+            failed = 1;
+            break;
+        }
+        if ( rc == 0 )
+        {
+            // due any moment; look again a sixteenth of a conversion on
+            struct timespec wait = { 0, period_us * 1000 / 16 };
+
+            nanosleep( &wait, NULL );
+            continue;
+        }
+
+        t_us = elapsed_us( &start, &poll );
+        if ( last_us >= 0 && t_us - last_us > period_us * 3 / 2 )
+        {
+            gaps++;
+        }
+        last_us = t_us;
+
+        sample.t_us = (uint32_t)t_us;
+        sample.shunt = shunt;
+        sample.bus = bus;
+        if ( fwrite( &sample, sizeof( sample ), 1, stdout ) != 1 )
+        {
+            failed = 1;
+            break;
+        }
+        count++;
+
+        // poll again once most of the next conversion has gone by
+        next = poll;
+        next.tv_nsec += period_us * 875;
+        if ( next.tv_nsec >= 1000000000 )
+        {
+            next.tv_sec += next.tv_nsec / 1000000000;
+            next.tv_nsec %= 1000000000;
+        }
+        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL );
+    }
+
+    if ( fflush( stdout ) != 0 )
+    {
+        failed = 1;
+    }
+    clock_gettime( CLOCK_MONOTONIC, &poll );
+    ina_register_write( ina, CONFIG_REG, config );
+
+    fprintf( stderr, "%ld conversions in %.3f s, %.0f per second (%.0f possible), %ld gaps%s\n",
+             count, elapsed_us( &start, &poll ) / 1e6,
+             count * 1e6 / ( elapsed_us( &start, &poll ) + 1 ), 1e6 / period_us, gaps,
+             rc < 0 ? ", stopped by a bus error" : failed ? ", stopped writing the stream" : "" );
+
+    return failed;
+}
+
+
+// A --stream back as text, one conversion per line; 1 if stdin is not one
+int decode( void )
+{
+    struct ina_stream_header header;
+    struct ina_stream_sample sample;
+    time_t seconds;
+    long long t_us = 0;
+    uint32_t last = 0;
+
+    if ( fread( &header, sizeof( header ), 1, stdin ) != 1 ||
+         header.magic != INA_STREAM_MAGIC || header.version != INA_STREAM_VERSION )
+    {
+        fprintf( stderr, "Not an ina219 stream\n" );
+        return 1;
+    }
+
+    seconds = header.start_ns / 1000000000;
+    printf( "# config 0x%04X, started %s", header.config, ctime( &seconds ) );
+    printf( "# ms mV mA\n" );
+
+    while ( fread( &sample, sizeof( sample ), 1, stdin ) == 1 )
+    {
+        // t_us wraps; the stream only moves forward
+        t_us += (uint32_t)( sample.t_us - last );
+        last = sample.t_us;
+        printf( "%.3f %d %.1f\n", t_us / 1000.0, ( sample.bus >> 3 ) * 4, sample.shunt / 10.0 );
+    }
+
+    return 0;
+}
+
+
 int main( int argc, char *argv[] )
 {
-    char filename[ 20 ];
+    int rc = 0;
 
     parse( argc, argv );
 
-    snprintf( filename, 19, "/dev/i2c-%d", i2c_bus );
-    handle = open( filename, O_RDWR );
-    if ( handle < 0 ) 
+    // needs no chip
+    if ( operation == OP_DECODE )
     {
-        fprintf( stderr, "Error opening bus %d: %s\n", i2c_bus, strerror( errno ) );
-        exit( 1 );
+        return decode();
     }
 
-    if ( ioctl( handle, I2C_SLAVE, i2c_address ) < 0 ) 
+    ina = ina_open( i2c_bus, i2c_address );
+    if ( ina == NULL )
     {
-        fprintf( stderr, "Error setting address %02X: %s\n", i2c_address, strerror( errno ) );
         exit( 1 );
     }
 
@@ -360,6 +492,12 @@ int main( int argc, char *argv[] )
             break;
         }
 
+        case OP_STREAM:
+        {
+            rc = stream();
+            break;
+        }
+
         default:
         case OP_NONE:
         {
@@ -367,7 +505,12 @@ int main( int argc, char *argv[] )
         }
     }
 
-    close( handle );
-    return 0;
+    if ( show_stats )
+    {
+        transport_print_stats( stderr, ina->bus );
+    }
+
+    ina_close( ina );
+    return rc;
 }
 
@@ -0,0 +1,60 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "powercaped.h"
+
+
+int pcd_connect( const char *path )
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+    if ( fd < 0 )
+    {
+        return -1;
+    }
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, path, sizeof( addr.sun_path ) - 1 );
+
+    // no daemon is not an error, callers fall back to the bus
+    if ( connect( fd, (struct sockaddr*)&addr, sizeof( addr ) ) < 0 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+
+int pcd_call( int fd, pcd_op op, int flags, int arg, struct pcd_reply *reply )
+{
+    return pcd_call_at( fd, op, flags, arg, 0, reply );
+}
+
+
+int pcd_call_at( int fd, pcd_op op, int flags, int arg, uint32_t when, struct pcd_reply *reply )
+{
+    struct pcd_request req;
+
+    req.op = op;
+    req.flags = flags;
+    req.arg = arg;
+    req.when = when;
+
+    if ( send( fd, &req, sizeof( req ), 0 ) != sizeof( req ) )
+    {
+        fprintf( stderr, "powercaped request failed: %s\n", strerror( errno ) );
+        return -1;
+    }
+
+    if ( recv( fd, reply, sizeof( *reply ), 0 ) != sizeof( *reply ) )
+    {
+        fprintf( stderr, "powercaped reply failed: %s\n", strerror( errno ) );
+        return -1;
+    }
+
+    return 0;
+}
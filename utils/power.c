@@ -3,8 +3,14 @@
  */
 
 
+#define _GNU_SOURCE
 #include <getopt.h>
+#include <sys/time.h>
+#include <math.h>
 #include "powercape.h"
+#include "powercaped.h"
+#include "drift.h"
+#include "discover.h"
 
 typedef enum {
     OP_NONE,
@@ -18,14 +24,39 @@ typedef enum {
     OP_CHARGE_TIME,
     OP_POWER_DOWN,
     OP_POWER_ON,
+    OP_WAKE_AT,
 } op_type;
 
-static op_type operation = OP_NONE;
-static int operation_arg = 0;
+static const char *op_names[] = {
+    "none", "boot", "query", "read", "set", "write", "info",
+    "charge", "charge-time", "power-down", "power-on", "wake-at",
+};
+
+#define MAX_OPERATIONS  16
+
+// operations run in the order given
+typedef struct {
+    op_type type;
+    int arg;
+    const char *text;               // wake time of OP_WAKE_AT
+    int rc;
+} operation;
+
+static operation operations[ MAX_OPERATIONS ];
+static int num_operations = 0;
+static int power_down_delay = 0;    // -p given along with -W
+static int use_daemon = 1;
+static int json = 0;
+static int discover = 0;
+static FILE *json_out = NULL;
+static int show_stats = 0;
+static int sync_rtc = 0;
 
 void show_usage( char *progname )
 {
-    fprintf( stderr, "Usage: %s [OPTION] \n", progname );
+    fprintf( stderr, "Usage: %s [OPTION]... \n", progname );
+    fprintf( stderr, "   Any number of operations may be given, they run in order over one bus\n" );
+    fprintf( stderr, "   open and stop at the first that fails.\n" );
     fprintf( stderr, "   Options:\n" );
     fprintf( stderr, "      -h --help           Show usage.\n" );
     fprintf( stderr, "      -i --info           Show PowerCape info.\n" );
@@ -35,15 +66,118 @@ void show_usage( char *progname )
     fprintf( stderr, "      -r --read           Read and display cape RTC value.\n" );
     fprintf( stderr, "      -s --set            Set system time from cape RTC.\n" );
     fprintf( stderr, "      -w --write          Write cape RTC from system time.\n" );
+    fprintf( stderr, "      -y --sync           With -s or -w, align to the RTC or system second to within\n" );
+    fprintf( stderr, "                          a few ms; takes up to a second (implies --no-daemon).\n" );
     fprintf( stderr, "      -cn --charge n      Set charge rate where n= 1, 2, or 3\n");
     fprintf( stderr, "      -tn --charge-time n Set charge time where n = 3-10 hours\n");
     fprintf( stderr, "      -pn --power-down n  Power down after n seconds where n=0-255\n");
-    fprintf( stderr, "      -Pn --power-on n    Power on after n seconds where n=0-22047555 (~255 days)\n");
+    fprintf( stderr, "      -Pn --power-on n    Power on after n seconds where n=0-%d (~10 days)\n", POWER_ON_MAX_SEC);
+    fprintf( stderr, "      -W --wake-at time   Power on at time by the cape RTC, counted from power down\n");
+    fprintf( stderr, "                          (with -p n, n seconds from now). time is HH:MM[:SS] (next\n");
+    fprintf( stderr, "                          occurrence), YYYY-MM-DD HH:MM[:SS] or @unix-seconds, local\n");
+    fprintf( stderr, "                          time unless followed by Z or UTC.\n");
+    fprintf( stderr, "      -n --no-daemon      Access the bus directly even if powercaped is running.\n");
+    fprintf( stderr, "      -S --stats          Print bus statistics to stderr (implies --no-daemon).\n");
+    fprintf( stderr, "      -D --discover       List the PowerCapes on all i2c buses and exit.\n");
+    fprintf( stderr, "      -j --json           After the operations print the results and the decoded\n");
+    fprintf( stderr, "                          registers as JSON; other output goes to stderr.\n");
     exit( 1 );
 }
 
+
+// Resolve a wake time against now, the cape rtc: a time of day means its
+// next occurrence
+int parse_wake_time( const char *arg, time_t now, time_t *when )
+{
+    static const char *formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%H:%M:%S", "%H:%M", NULL };
+    struct tm tm, today;
+    const char *rest = NULL;
+    char *end;
+    int utc;
+    int i;
+
+    if ( arg[ 0 ] == '@' )
+    {
+        *when = strtol( arg + 1, &end, 10 );
+        return ( end == arg + 1 || *end != '\0' ) ? -1 : 0;
+    }
+
+    for ( i = 0; formats[ i ] != NULL && rest == NULL; i++ )
+    {
+        memset( &tm, 0, sizeof( tm ) );
+        rest = strptime( arg, formats[ i ], &tm );
+    }
+    if ( rest == NULL )
+    {
+        return -1;
+    }
+
+    while ( *rest == ' ' )
+        rest++;
+    utc = strcmp( rest, "Z" ) == 0 || strcmp( rest, "UTC" ) == 0;
+    if ( !utc && *rest != '\0' )
+    {
+        return -1;
+    }
+
+    // a time of day alone takes the date from now
+    if ( formats[ i - 1 ][ 1 ] == 'H' )
+    {
+        if ( utc )
+            gmtime_r( &now, &today );
+        else
+            localtime_r( &now, &today );
+        tm.tm_year = today.tm_year;
+        tm.tm_mon = today.tm_mon;
+        tm.tm_mday = today.tm_mday;
+    }
+
+    tm.tm_isdst = -1;
+    *when = utc ? timegm( &tm ) : mktime( &tm );
+    if ( formats[ i - 1 ][ 1 ] == 'H' && *when <= now )
+    {
+        tm.tm_mday++;
+        tm.tm_isdst = -1;
+        *when = utc ? timegm( &tm ) : mktime( &tm );
+    }
+
+    return 0;
+}
+
+
+static void add_operation( op_type type, int arg, const char *text, char *progname )
+{
+    if ( num_operations == MAX_OPERATIONS )
+    {
+        fprintf( stderr, "At most %d operations\n", MAX_OPERATIONS );
+        show_usage( progname );
+    }
+
+    operations[ num_operations ].type = type;
+    operations[ num_operations ].arg = arg;
+    operations[ num_operations ].text = text;
+    num_operations++;
+}
+
+
+static int parse_arg( const char *arg, int min, int max, char *progname )
+{
+    int n = atoi( arg );
+
+    if ( n < min || n > max )
+    {
+        show_usage( progname );
+    }
+
+    return n;
+}
+
+
 void parse( int argc, char *argv[] )
 {
+    int wake = 0;
+    int i, n;
+
     while( 1 )
     {
         static const struct option lopts[] =
@@ -59,11 +193,17 @@ void parse( int argc, char *argv[] )
             { "charge-time", 1, 0, 't' },
             { "power-down",  1, 0, 'p' },
             { "power-on",    1, 0, 'P' },
+            { "wake-at",     1, 0, 'W' },
+            { "no-daemon",   0, 0, 'n' },
+            { "stats",       0, 0, 'S' },
+            { "sync",        0, 0, 'y' },
+            { "json",        0, 0, 'j' },
+            { "discover",    0, 0, 'D' },
             { NULL,          0, 0, 0 },
         };
         int c;
 
-        c = getopt_long( argc, argv, "ihbqrswc:t:p:P:", lopts, NULL );
+        c = getopt_long( argc, argv, "ihbqrswnSyjDc:t:p:P:W:", lopts, NULL );
 
         if( c == -1 )
             break;
@@ -72,188 +212,742 @@ void parse( int argc, char *argv[] )
         {
             case 'b':
             {
-                operation = OP_BOOT;
+                add_operation( OP_BOOT, 0, NULL, argv[ 0 ] );
                 break;
             }
 
             case 'i':
             {
-                operation = OP_INFO;
+                add_operation( OP_INFO, 0, NULL, argv[ 0 ] );
                 break;
             }
 
             case 'q':
             {
-                operation = OP_QUERY;
+                add_operation( OP_QUERY, 0, NULL, argv[ 0 ] );
                 break;
             }
 
             case 'r':
             {
-                operation = OP_READ_RTC;
+                add_operation( OP_READ_RTC, 0, NULL, argv[ 0 ] );
                 break;
             }
 
             case 's':
             {
-                operation = OP_SET_SYSTIME;
+                add_operation( OP_SET_SYSTIME, 0, NULL, argv[ 0 ] );
                 break;
             }
 
             case 'w':
             {
-                operation = OP_WRITE_RTC;
+                add_operation( OP_WRITE_RTC, 0, NULL, argv[ 0 ] );
+                break;
+            }
+
+            case 'n':
+            {
+                use_daemon = 0;
+                break;
+            }
+
+            case 'y':
+            {
+                // timing is measured here, not across the daemon socket
+                sync_rtc = 1;
+                use_daemon = 0;
+                break;
+            }
+
+            case 'S':
+            {
+                // the statistics belong to the transport this process opens
+                show_stats = 1;
+                use_daemon = 0;
+                break;
+            }
+
+            case 'j':
+            {
+                json = 1;
+                break;
+            }
+
+            case 'D':
+            {
+                discover = 1;
                 break;
             }
 
             case 'h':
             {
-                operation = OP_NONE;
                 show_usage( argv[ 0 ] );
                 break;
             }
             case 'c':
             {
-                operation = OP_CHARGE;
-                operation_arg = atoi(optarg);
-                if ((operation_arg < CHARGE_RATE_LOW) || (operation_arg > CHARGE_RATE_HIGH))
-                {
-                    operation = OP_NONE;
-                    show_usage( argv[ 0 ] );
-                }
+                n = parse_arg( optarg, CHARGE_RATE_LOW, CHARGE_RATE_HIGH, argv[ 0 ] );
+                add_operation( OP_CHARGE, n, NULL, argv[ 0 ] );
                 break;
             }
             case 't':
             {
-                operation = OP_CHARGE_TIME;
-                operation_arg = atoi(optarg);
-                if ((operation_arg < CHARGE_TIME_MIN) || (operation_arg > CHARGE_TIME_MAX))
-                {
-                    operation = OP_NONE;
-                    show_usage( argv[ 0] );
-                }
+                n = parse_arg( optarg, CHARGE_TIME_MIN, CHARGE_TIME_MAX, argv[ 0 ] );
+                add_operation( OP_CHARGE_TIME, n, NULL, argv[ 0 ] );
                 break;
             }
             case 'p':
             {
-                operation = OP_POWER_DOWN;
-                operation_arg = atoi(optarg);
-                if ((operation_arg < POWER_DOWN_MIN_SEC) || (operation_arg > POWER_DOWN_MAX_SEC))
-                {
-                    operation = OP_NONE;
-                    show_usage(argv[0]);
-                }
+                n = parse_arg( optarg, POWER_DOWN_MIN_SEC, POWER_DOWN_MAX_SEC, argv[ 0 ] );
+                add_operation( OP_POWER_DOWN, n, NULL, argv[ 0 ] );
+                power_down_delay = n;
                 break;
             }
             case 'P':
             {
-                operation = OP_POWER_ON;
-                operation_arg = atoi(optarg);
-                if ((operation_arg < POWER_ON_MIN_SEC) || (operation_arg > POWER_DOWN_MAX_SEC))
+                n = parse_arg( optarg, POWER_ON_MIN_SEC, POWER_ON_MAX_SEC, argv[ 0 ] );
+                add_operation( OP_POWER_ON, n, NULL, argv[ 0 ] );
+                break;
+            }
+            case 'W':
+            {
+                time_t when;
+
+                if (parse_wake_time(optarg, time(NULL), &when) != 0)
                 {
-                    operation = OP_NONE;
+                    fprintf(stderr, "Unknown wake time %s\n", optarg);
                     show_usage(argv[0]);
                 }
+                add_operation( OP_WAKE_AT, 0, optarg, argv[ 0 ] );
+                wake = 1;
                 break;
             }
+            default:
+            {
+                show_usage( argv[ 0 ] );
+                break;
+            }
+        }
+    }
+
+    // with -W the delay is part of the wake schedule
+    if ( wake )
+    {
+        for ( i = 0, n = 0; i < num_operations; i++ )
+        {
+            if ( operations[ i ].type != OP_POWER_DOWN )
+            {
+                operations[ n++ ] = operations[ i ];
+            }
         }
+        num_operations = n;
     }
 }
 
 
-int main( int argc, char *argv[] )
+int set_system_time( time_t seconds, long usec )
 {
-    int rc = 0;
-    char filename[ 20 ];
+    int rc;
+    struct timeval t;
 
-    if ( argc == 1 )
+    t.tv_sec = seconds;
+    t.tv_usec = usec;
+    rc = settimeofday( &t, NULL );
+    if ( rc != 0 )
     {
-        show_usage( argv[ 0 ] );
+        fprintf( stderr, "Error: %s\n", strerror( errno ) );
     }
 
-    parse( argc, argv );
+    return rc;
+}
 
-    if (cape_initialize(CAPE_I2C_BUS, AVR_ADDRESS) < 0)
+
+// Drift model capedrift measured for this cape, 0 when there is one
+static int load_drift( cape_drift *drift )
+{
+    char path[ 256 ];
+
+    cape_drift_path( path, sizeof( path ), CAPE_I2C_BUS, AVR_ADDRESS );
+    return cape_drift_load( path, drift );
+}
+
+
+// Set the system time from a cape reading, taking out what the cape has
+// gained or lost since its clock was last set
+int set_system_time_rtc( double cape_time )
+{
+    cape_drift drift;
+    double t = cape_time;
+
+    if ( load_drift( &drift ) == 0 )
     {
-        exit(1);
+        t = cape_drift_true_time( &drift, cape_time );
+        if ( fabs( t - cape_time ) >= 0.001 )
+        {
+            fprintf( stderr, "RTC drift correction %+.3f s\n", t - cape_time );
+        }
     }
 
-    switch ( operation )
+    return set_system_time( (time_t)floor( t ), (long)( ( t - floor( t ) ) * 1000000 ) );
+}
+
+
+// The cape clock was just set: the model's rate still holds, its offset
+// starts over from offset (cape minus system seconds)
+void restart_drift( double offset )
+{
+    char path[ 256 ];
+    cape_drift drift;
+    struct timespec now;
+
+    if ( load_drift( &drift ) != 0 )
+    {
+        return;
+    }
+
+    clock_gettime( CLOCK_REALTIME, &now );
+    drift.reference = now.tv_sec + now.tv_nsec / 1e9;
+    drift.offset = offset;
+    cape_drift_path( path, sizeof( path ), CAPE_I2C_BUS, AVR_ADDRESS );
+    cape_drift_save( path, &drift );
+}
+
+
+// Cape rtc value to count down to so the cape wakes at arg by the system
+// clock; *when is that time
+time_t wake_target( const char *arg, time_t rtc, time_t *when )
+{
+    cape_drift drift;
+
+    if ( load_drift( &drift ) != 0 )
+    {
+        parse_wake_time( arg, rtc, when );
+        return *when;
+    }
+
+    parse_wake_time( arg, (time_t)floor( cape_drift_true_time( &drift, rtc ) + 0.5 ), when );
+    return cape_drift_wake_time( &drift, *when, rtc );
+}
+
+
+// Registers a read-only operation shows, 0 for the others
+static int read_range( op_type type, int *first, int *last )
+{
+    switch ( type )
+    {
+        case OP_QUERY:
+            *first = *last = REG_START_REASON;
+            return 1;
+
+        case OP_READ_RTC:
+            *first = REG_SECONDS_0;
+            *last = REG_SECONDS_3;
+            return 1;
+
+        case OP_INFO:
+            *first = 0;
+            *last = NUM_REGISTERS - 1;
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+
+// Show a read-only operation from the snapshot
+static void show( const cape_registers *regs, op_type type )
+{
+    time_t seconds;
+
+    switch ( type )
     {
         case OP_INFO:
+            cape_print_info( regs );
+            break;
+
+        case OP_QUERY:
+            cape_print_reason_power_on( regs );
+            break;
+
+        case OP_READ_RTC:
+            seconds = cape_snapshot_seconds( regs );
+            printf( "%s", ctime( &seconds ) );
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+// A JSON string: quotes, backslashes and control characters escaped
+static void print_json_string( FILE *f, const char *s )
+{
+    fputc( '"', f );
+    for ( ; *s != '\0'; s++ )
+    {
+        unsigned char c = *s;
+
+        if ( c == '"' || c == '\\' )
+            fprintf( f, "\\%c", c );
+        else if ( c < 0x20 )
+            fprintf( f, "\\u%04x", c );
+        else
+            fputc( c, f );
+    }
+    fputc( '"', f );
+}
+
+
+// Results of the operations run, the registers as they are afterwards and
+// the power monitor when the daemon had it
+static void print_json( int rc, int ran, const cape_registers *regs, const struct pcd_reply *ina )
+{
+    int i;
+
+    fprintf( json_out, "{\n\"rc\": %d,\n\"operations\": [", rc );
+    for ( i = 0; i < ran; i++ )
+    {
+        fprintf( json_out, "%s\n  { \"op\": \"%s\", \"arg\": ", i ? "," : "", op_names[ operations[ i ].type ] );
+        if ( operations[ i ].text != NULL )
+            print_json_string( json_out, operations[ i ].text );
+        else
+            fprintf( json_out, "%d", operations[ i ].arg );
+        fprintf( json_out, ", \"rc\": %d }", operations[ i ].rc );
+    }
+    fprintf( json_out, "%s],\n\"cape\": ", ran ? "\n" : "" );
+
+    if ( regs != NULL )
+        cape_print_json( json_out, regs );
+    else
+        fprintf( json_out, "null" );
+
+    if ( ina != NULL && ina->ina_valid )
+    {
+        fprintf( json_out, ",\n\"ina219\": { \"mv\": %.1f, \"ma\": %.1f, \"age_ms\": %u }",
+                 ina->mv, ina->ma, ina->age_ms );
+    }
+    fprintf( json_out, "\n}\n" );
+    fflush( json_out );
+}
+
+
+// Run one operation that changes something through powercaped
+static int daemon_operation( int fd, operation *op )
+{
+    struct pcd_reply reply;
+    time_t seconds;
+    int rc = 1;
+
+    switch ( op->type )
+    {
+        case OP_SET_SYSTIME:
         {
-            rc = cape_show_cape_info();
+            // the clock must not be set from a cached second
+            if ( pcd_call( fd, PCD_OP_SNAPSHOT, PCD_FLAG_FRESH, 0, &reply ) != 0 || !reply.regs_valid )
+            {
+                break;
+            }
+
+            seconds = cape_snapshot_seconds( &reply.regs );
+            printf( "%s", ctime( &seconds ) );
+            rc = set_system_time_rtc( seconds );
             break;
         }
 
-        case OP_QUERY:
+        case OP_WRITE_RTC:
         {
-            rc = cape_query_reason_power_on();
+            seconds = time( NULL );
+            printf( "%s", ctime( &seconds ) );
+            if ( pcd_call( fd, PCD_OP_WRITE_RTC, 0, 0, &reply ) == 0 )
+            {
+                rc = reply.rc;
+            }
+            if ( rc == 0 )
+            {
+                // written within the second, at a point the daemon chose
+                restart_drift( -0.5 );
+            }
             break;
         }
 
         case OP_BOOT:
+        case OP_CHARGE:
+        case OP_CHARGE_TIME:
+        case OP_POWER_DOWN:
+        case OP_POWER_ON:
         {
-            rc = cape_enter_bootloader();
+            pcd_op pop = op->type == OP_BOOT ? PCD_OP_BOOT :
+                         op->type == OP_CHARGE ? PCD_OP_CHARGE :
+                         op->type == OP_CHARGE_TIME ? PCD_OP_CHARGE_TIME :
+                         op->type == OP_POWER_DOWN ? PCD_OP_POWER_DOWN : PCD_OP_POWER_ON;
+
+            if ( pcd_call( fd, pop, 0, op->arg, &reply ) == 0 )
+            {
+                rc = reply.rc;
+            }
             break;
         }
 
-        case OP_READ_RTC:
+        case OP_WAKE_AT:
         {
-            rc = cape_read_rtc( NULL );
+            time_t when, target;
+
+            // the time of day is resolved against the cape's clock
+            if ( pcd_call( fd, PCD_OP_SNAPSHOT, PCD_FLAG_FRESH, 0, &reply ) != 0 || !reply.regs_valid )
+            {
+                break;
+            }
+
+            target = wake_target( op->text, cape_snapshot_seconds( &reply.regs ), &when );
+            if ( target < 0 || (long long)target > UINT32_MAX )
+            {
+                fprintf( stderr, "Wake time is beyond the cape RTC\n" );
+                break;
+            }
+            if ( pcd_call_at( fd, PCD_OP_WAKE_AT, 0, power_down_delay, (uint32_t)target, &reply ) == 0 )
+            {
+                rc = reply.rc;
+            }
+            if ( rc == 0 )
+            {
+                printf( "Wake at %s", ctime( &when ) );
+            }
             break;
         }
 
-        case OP_SET_SYSTIME:
+        default:
         {
-            struct timeval t;
+            rc = 0;
+            break;
+        }
+    }
+
+    return rc;
+}
+
 
-            rc = cape_read_rtc( &t.tv_sec );
+// Run the requested operations through powercaped, which answers reads
+// from its cached snapshot instead of touching the bus
+int run_daemon( int fd )
+{
+    struct pcd_reply snap;
+    int valid = 0;              // snap is current, no write since
+    int rc = 0;
+    int first, last;
+    int i;
+
+    for ( i = 0; i < num_operations && rc == 0; i++ )
+    {
+        if ( read_range( operations[ i ].type, &first, &last ) )
+        {
+            if ( !valid )
+            {
+                valid = pcd_call( fd, PCD_OP_SNAPSHOT, 0, 0, &snap ) == 0 && snap.regs_valid;
+            }
+            rc = valid ? 0 : 1;
             if ( rc == 0 )
             {
-                t.tv_usec = 0;
-                rc = settimeofday( &t, NULL);
-                if ( rc != 0 )
+                show( &snap.regs, operations[ i ].type );
+            }
+        }
+        else
+        {
+            valid = 0;
+            rc = daemon_operation( fd, &operations[ i ] );
+        }
+        operations[ i ].rc = rc;
+    }
+
+    if ( json )
+    {
+        if ( !valid )
+        {
+            valid = pcd_call( fd, PCD_OP_SNAPSHOT, 0, 0, &snap ) == 0 && snap.regs_valid;
+        }
+        print_json( rc, i, valid ? &snap.regs : NULL, valid ? &snap : NULL );
+    }
+
+    close( fd );
+    return rc;
+}
+
+
+// Run one operation that changes something on the bus
+static int direct_operation( operation *op )
+{
+    int rc = 1;
+
+    switch ( op->type )
+    {
+        case OP_BOOT:
+        {
+            rc = cape_enter_bootloader();
+            break;
+        }
+
+        case OP_SET_SYSTIME:
+        {
+            time_t seconds;
+            struct timespec ts;
+
+            if ( sync_rtc )
+            {
+                rc = cape_read_rtc_sync( &ts );
+                if ( rc == 0 )
                 {
-                    fprintf( stderr, "Error: %s\n", strerror( errno ) );
+                    rc = set_system_time_rtc( ts.tv_sec + ts.tv_nsec / 1e9 );
                 }
+                break;
+            }
+
+            rc = cape_read_rtc( &seconds );
+            if ( rc == 0 )
+            {
+                rc = set_system_time_rtc( seconds );
             }
             break;
         }
 
         case OP_WRITE_RTC:
         {
+            long offset_us;
+
+            if ( sync_rtc )
+            {
+                rc = cape_write_rtc_sync( &offset_us );
+                if ( rc == 0 && offset_us != 0 )
+                {
+                    fprintf( stderr, "Cape firmware keeps its own tick phase, RTC seconds start %+ld ms from the system's\n",
+                             offset_us / 1000 );
+                }
+                if ( rc == 0 )
+                {
+                    restart_drift( -offset_us / 1e6 );
+                }
+                break;
+            }
+
             rc = cape_write_rtc();
+            if ( rc == 0 )
+            {
+                restart_drift( -0.5 );
+            }
             break;
         }
 
         case OP_CHARGE:
         {
-            rc = cape_charge_rate(operation_arg);
+            rc = cape_charge_rate(op->arg);
             break;
         }
         case OP_CHARGE_TIME:
         {
-            rc = cape_charge_time(operation_arg);
+            rc = cape_charge_time(op->arg);
             break;
         }
         case OP_POWER_DOWN:
         {
-            rc = cape_power_down(operation_arg);
+            rc = cape_power_down(op->arg);
             break;
         }
         case OP_POWER_ON:
         {
-            rc = cape_power_on(operation_arg);
+            rc = cape_power_on(op->arg);
+            break;
+        }
+        case OP_WAKE_AT:
+        {
+            cape_registers regs;
+            time_t when, target;
+
+            if ( cape_snapshot_range( &regs, REG_SECONDS_0, 4 ) == 0 )
+            {
+                target = wake_target( op->text, cape_snapshot_seconds( &regs ), &when );
+                rc = cape_wake_at( target, power_down_delay );
+            }
+            if ( rc == 0 )
+            {
+                printf( "Wake at %s", ctime( &when ) );
+            }
             break;
         }
         default:
-        case OP_NONE:
         {
+            rc = 0;
             break;
         }
     }
 
+    return rc;
+}
+
+
+// Read-only operations in a row are shown from one burst read covering
+// all of them, the whole register file when the JSON at the end can use
+// it too
+int run_direct( void )
+{
+    cape_registers regs;
+    int valid = 0;              // what regs hold is current, no write since
+    int full = 0;               // and it is the whole register file
+    int rc = 0;
+    int first, last, f, l;
+    int i, j;
+
+    for ( i = 0; i < num_operations && rc == 0; i++ )
+    {
+        if ( !read_range( operations[ i ].type, &first, &last ) )
+        {
+            valid = 0;
+            rc = direct_operation( &operations[ i ] );
+            operations[ i ].rc = rc;
+            continue;
+        }
+
+        if ( !valid )
+        {
+            for ( j = i + 1; j < num_operations && read_range( operations[ j ].type, &f, &l ); j++ )
+            {
+                first = f < first ? f : first;
+                last = l > last ? l : last;
+            }
+            if ( json && j == num_operations )
+            {
+                first = 0;
+                last = NUM_REGISTERS - 1;
+            }
+
+            valid = cape_snapshot_range( &regs, first, last - first + 1 ) == 0;
+            full = first == 0 && last == NUM_REGISTERS - 1;
+        }
+
+        rc = valid ? 0 : 1;
+        if ( rc == 0 )
+        {
+            show( &regs, operations[ i ].type );
+        }
+        operations[ i ].rc = rc;
+    }
+
+    if ( json )
+    {
+        if ( !valid || !full )
+        {
+            valid = cape_snapshot( &regs ) == 0;
+        }
+        print_json( rc, i, valid ? &regs : NULL, NULL );
+    }
+
+    return rc;
+}
+
+
+// Capes on any bus and address, with their board if they report it
+int run_discover( void )
+{
+    cape_found found[ 16 ];
+    cape_registers regs;
+    int n, i;
+
+    n = cape_discover( found, 16, DISCOVER_FIRST_ADDRESS, DISCOVER_LAST_ADDRESS );
+
+    if ( json )
+        fprintf( json_out, "[" );
+    for ( i = 0; i < n; i++ )
+    {
+        cape_t *cape = found[ i ].cape;
+        const char *board = "";
+        unsigned char revision, stepping;
+        char name[ 64 ];
+
+        // only the board bytes are read, the capability is already known
+        memset( &regs, 0, sizeof( regs ) );
+        regs.reg[ REG_EXTENDED ] = 0x69;
+        regs.reg[ REG_CAPABILITY ] = found[ i ].capability;
+        if ( found[ i ].capability >= CAPABILITY_WDT &&
+             cape_snapshot_range_r( cape, &regs, REG_BOARD_TYPE, 3 ) == 0 )
+        {
+            board = cape_snapshot_board( &regs, &revision, &stepping );
+            snprintf( name, sizeof( name ), "%s PowerCape %c%c", board, revision, stepping );
+            board = name;
+        }
+
+        if ( json )
+        {
+            fprintf( json_out, "%s\n  { \"bus\": %d, \"address\": %d, \"capability\": %d, \"board\": ",
+                     i ? "," : "", cape->i2c_bus, cape->address, found[ i ].capability );
+            print_json_string( json_out, board );
+            fprintf( json_out, " }" );
+        }
+        else
+        {
+            printf( "bus %d address 0x%02x capability %d %s\n",
+                    cape->i2c_bus, cape->address, found[ i ].capability, board );
+        }
+    }
+    if ( json )
+    {
+        fprintf( json_out, "%s]\n", n ? "\n" : "" );
+        fflush( json_out );
+    }
+
+    if ( n == 0 && !json )
+    {
+        fprintf( stderr, "No PowerCape found\n" );
+    }
+
+    cape_discover_free( found, n );
+    return n > 0 ? 0 : 1;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    int rc = 0;
+
+    if ( argc == 1 )
+    {
+        show_usage( argv[ 0 ] );
+    }
+
+    parse( argc, argv );
+
+    // the JSON keeps stdout to itself
+    if ( json )
+    {
+        json_out = fdopen( dup( STDOUT_FILENO ), "w" );
+        dup2( STDERR_FILENO, STDOUT_FILENO );
+    }
+
+    if ( discover )
+    {
+        return run_discover();
+    }
+
+    if ( use_daemon )
+    {
+        int fd = pcd_connect( PCD_SOCKET_PATH );
+        if ( fd >= 0 )
+        {
+            return run_daemon( fd );
+        }
+    }
+
+    if (cape_initialize(CAPE_I2C_BUS, AVR_ADDRESS) < 0)
+    {
+        exit(1);
+    }
+
+    rc = run_direct();
+
+    if ( show_stats )
+    {
+        cape_print_stats( stderr );
+    }
+
     cape_close();
     return rc;
 }
@@ -1,86 +1,158 @@
 #include "powercape.h"
 
-// misc constants
-#define I2C_MAX_DEVICE_NAME 0x0C     // maximum length of i2c filename
+// pause between reads while waiting for the rtc to tick; bounds the
+// timing error together with the read time and leaves the bus to others
+#define RTC_POLL_US     500
 
-// global struct to hold needed powercap data
-static powercape pc;
+// default handle used by the single-cape wrappers
+static cape_t *pc = NULL;
 
 void msleep( int msecs )
 {
     usleep( msecs * 1000 );
 }
 
-int i2c_read( void *buf, int len )
+static int i2c_write( cape_t *cape, void *buf, int len )
 {
     int rc = 0;
-    pc.status = CAPE_OK;
+    struct i2c_msg msg;
+    cape->status = CAPE_OK;
 
-    if ( read( pc.handle, buf, len ) != len )
+    msg.addr = cape->address;
+    msg.flags = 0;
+    msg.len = len;
+    msg.buf = buf;
+
+    if ( transport_transfer( cape->bus, &msg, 1 ) != 0 )
     {
-        fprintf(stderr, "I2C read failed: %s\n", strerror( errno ) );
+        fprintf(stderr, "I2C write failed: %s\n", strerror( errno ) );
         rc = -1;
-        pc.status = CAPE_ERROR;
+        cape->status = CAPE_ERROR;
     }
-
+    
     return rc;
 }
 
 
-int i2c_write( void *buf, int len )
+static int i2c_write_read( cape_t *cape, void *wbuf, int wlen, void *rbuf, int rlen )
 {
     int rc = 0;
-    pc.status = CAPE_OK;
+    struct i2c_msg msgs[ 2 ];
+    cape->status = CAPE_OK;
 
-    if ( write( pc.handle, buf, len ) != len )
+    // write then read joined by a repeated start, so nothing else on the
+    // bus can move the avr register index between the two halves
+    msgs[ 0 ].addr = cape->address;
+    msgs[ 0 ].flags = 0;
+    msgs[ 0 ].len = wlen;
+    msgs[ 0 ].buf = wbuf;
+    msgs[ 1 ].addr = cape->address;
+    msgs[ 1 ].flags = I2C_M_RD;
+    msgs[ 1 ].len = rlen;
+    msgs[ 1 ].buf = rbuf;
+
+    if ( transport_transfer( cape->bus, msgs, 2 ) != 0 )
     {
-        fprintf(stderr, "I2C write failed: %s\n", strerror( errno ) );
+        fprintf(stderr, "I2C transfer failed: %s\n", strerror( errno ) );
         rc = -1;
-        pc.status = CAPE_ERROR;
+        cape->status = CAPE_ERROR;
     }
-    
+
     return rc;
 }
 
 
-int register_read( unsigned char reg, unsigned char *data )
+static int register_block_read( cape_t *cape, unsigned char reg, void *buf, int len )
 {
-    int rc = -1;
-    unsigned char bite[ 4 ];
-    
-    bite[ 0 ] = reg;
-    if ( i2c_write( bite, 1 ) == 0 )
+    return i2c_write_read( cape, &reg, 1, buf, len );
+}
+
+
+static int register_read( cape_t *cape, unsigned char reg, unsigned char *data )
+{
+    return register_block_read( cape, reg, data, 1 );
+}
+
+
+static long long now_ns( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+// registers the firmware changes by itself: inputs, the start reason and
+// enable, and the clock and countdowns it steps every second
+static const unsigned char volatile_registers[] = {
+    REG_STATUS, REG_START_REASON, REG_START_ENABLE,
+    REG_RESTART_HOURS, REG_RESTART_MINUTES, REG_RESTART_SECONDS,
+    REG_SECONDS_0, REG_SECONDS_1, REG_SECONDS_2, REG_SECONDS_3,
+    REG_WDT_RESET, REG_WDT_POWER, REG_WDT_STOP, REG_WDT_START,
+};
+
+
+static void cache_init( cape_cache *cache )
+{
+    int i, j;
+
+    memset( cache, 0, sizeof( cape_cache ) );
+    pthread_mutex_init( &cache->lock, NULL );
+    pthread_cond_init( &cache->done, NULL );
+
+    for ( i = 0; i < NUM_REGISTERS; i++ )
+    {
+        cache->ttl_ms[ i ] = CAPE_CACHE_TTL_MS;
+    }
+    for ( i = 0; i < (int)sizeof( volatile_registers ); i++ )
     {
-        if ( i2c_read( bite, 1 ) == 0 )
+        cache->ttl_ms[ volatile_registers[ i ] ] = CAPE_CACHE_VOLATILE_MS;
+    }
+
+    // fixed for as long as the firmware runs
+    for ( i = 0; i < cape_register_count; i++ )
+    {
+        const cape_register_desc *desc = &cape_register_map[ i ];
+
+        if ( desc->flags & REG_FLAG_FIXED )
         {
-            *data = bite[ 0 ];
-            rc = 0;
+            for ( j = desc->first; j < desc->first + desc->width; j++ )
+            {
+                cache->ttl_ms[ j ] = CAPE_CACHE_FOREVER;
+            }
         }
     }
-    
-    return rc;
 }
 
 
-int register32_read( unsigned char reg, unsigned int *data )
+static void cache_destroy( cape_cache *cache )
 {
-    int rc = -1;
-    unsigned char bite[ 4 ];
-    
-    bite[ 0 ] = reg;
-    if ( i2c_write( bite, 1 ) == 0 )
+    pthread_cond_destroy( &cache->done );
+    pthread_mutex_destroy( &cache->lock );
+}
+
+
+// Forget registers a write may have changed. Called after the write
+// completes; the generation bump keeps a read that was already in flight
+// from storing pre-write values.
+static void cache_invalidate( cape_t *cape, int first, int count )
+{
+    cape_cache *cache = &cape->cache;
+
+    pthread_mutex_lock( &cache->lock );
+    memset( &cache->valid[ first ], 0, count );
+    if ( first <= REG_RESTART_SECONDS && first + count > REG_RESTART_HOURS )
     {
-        if ( i2c_read( data, 4 ) == 0 )
-        {
-            rc = 0;
-        }
+        // the firmware sets START_TIMEOUT when a countdown is written
+        cache->valid[ REG_START_ENABLE ] = 0;
     }
-    
-    return rc;
+    cache->generation++;
+    pthread_mutex_unlock( &cache->lock );
 }
 
 
-int register_write( unsigned char reg, unsigned char data )
+static int register_write( cape_t *cape, unsigned char reg, unsigned char data )
 {
     int rc = -1;
     unsigned char bite[ 4 ];
@@ -88,81 +160,147 @@ int register_write( unsigned char reg, unsigned char data )
     bite[ 0 ] = reg;
     bite[ 1 ] = data;
 
-    if ( i2c_write( bite, 2 ) == 0 )
+    if ( i2c_write( cape, bite, 2 ) == 0 )
     {
         rc = 0;
     }
+    cache_invalidate( cape, reg, 1 );
     
     return rc;
 }
 
 
-int register32_write( unsigned char reg, unsigned int data )
+static int register_block_write( cape_t *cape, unsigned char reg, const unsigned char *data, int len )
 {
     int rc = -1;
-    unsigned char bite[ 6 ];
-    
+    unsigned char bite[ NUM_REGISTERS + 1 ];
+
+    if ( len < 1 || reg + len > NUM_REGISTERS )
+    {
+        fprintf( stderr, "Register range %d+%d is out of range\n", reg, len );
+        return rc;
+    }
+
+    // the avr stores each data byte at an auto-incremented register index
     bite[ 0 ] = reg;
-    bite[ 1 ] = data & 0xFF;
-    bite[ 2 ] = ( data >> 8 ) & 0xFF;
-    bite[ 3 ] = ( data >> 16 ) & 0xFF;
-    bite[ 4 ] = ( data >> 24 ) & 0xFF;
+    memcpy( &bite[ 1 ], data, len );
 
-    if ( i2c_write( bite, 5 ) == 0 )
+    if ( i2c_write( cape, bite, len + 1 ) == 0 )
     {
         rc = 0;
     }
-    
+    cache_invalidate( cape, reg, len );
+
     return rc;
 }
 
-int cape_initialize(int i2c_bus, int avr_address)
+
+static int register32_write( cape_t *cape, unsigned char reg, unsigned int data )
 {
-    int rc = 0;
-    pc.i2c_bus = i2c_bus;
-    pc.handle = 0;
-    pc.status = CAPE_OK;
-    char filename[I2C_MAX_DEVICE_NAME];
-    snprintf(filename, I2C_MAX_DEVICE_NAME, "/dev/i2c-%d", i2c_bus);
-    pc.handle = open(filename, O_RDWR);
-    if (pc.handle == -1)
-    {
-        fprintf(stderr, "Failed to open %s: (%d) %s\n", filename, errno, strerror(errno));
-        rc = -1;
-        pc.status = CAPE_FAIL;
+    unsigned char bite[ 4 ];
+    
+    bite[ 0 ] = data & 0xFF;
+    bite[ 1 ] = ( data >> 8 ) & 0xFF;
+    bite[ 2 ] = ( data >> 16 ) & 0xFF;
+    bite[ 3 ] = ( data >> 24 ) & 0xFF;
+
+    return register_block_write( cape, reg, bite, 4 );
+}
+
+
+cape_t *cape_attach( transport_t *bus, int avr_address )
+{
+    cape_t *cape;
+
+    cape = calloc( 1, sizeof( cape_t ) );
+    if ( cape == NULL )
+    {
+        fprintf(stderr, "Out of memory allocating cape handle\n");
+        return NULL;
     }
 
-    if (ioctl(pc.handle, I2C_SLAVE, avr_address) < 0)
+    cape->i2c_bus = bus->i2c_bus;
+    cape->address = avr_address;
+    cape->bus = bus;
+    cape->status = CAPE_OK;
+    pthread_mutex_init( &cape->lock, NULL );
+    cache_init( &cape->cache );
+
+    return cape;
+}
+
+
+cape_t *cape_open( int i2c_bus, int avr_address )
+{
+    cape_t *cape;
+    transport_t *bus;
+
+    bus = transport_open( i2c_bus );
+    if ( bus == NULL )
     {
-        fprintf(stderr, "IOCTL Error: %s\n", strerror(errno));
-        rc = -1;
+        return NULL;
     }
 
-    return rc;
+    cape = cape_attach( bus, avr_address );
+    if ( cape == NULL )
+    {
+        transport_close( bus );
+        return NULL;
+    }
+
+    cape->owns_bus = 1;
+    return cape;
 }
 
-int cape_close(void)
+
+int cape_close_r( cape_t *cape )
 {
-    int rc = 0;
-    if (pc.handle != 0)
+    if ( cape == NULL )
     {
-        rc = close(pc.handle);
-        if (rc == -1)
-        {
-            fprintf(stderr, "Error closing handler: (%d) %s\n", errno, strerror(errno));
-        }
+        return 0;
     }
-    return rc;
+
+    if ( cape->owns_bus )
+    {
+        transport_close( cape->bus );
+    }
+    cache_destroy( &cape->cache );
+    pthread_mutex_destroy( &cape->lock );
+    free( cape );
+
+    return 0;
 }
 
-int cape_enter_bootloader( void )
+
+int cape_status_r( cape_t *cape )
+{
+    int status;
+
+    pthread_mutex_lock( &cape->lock );
+    status = cape->status;
+    pthread_mutex_unlock( &cape->lock );
+
+    return status;
+}
+
+
+// Bus counters and latency histograms, shared with any other handle on
+// the same transport
+void cape_print_stats_r( cape_t *cape, FILE *f )
+{
+    transport_print_stats( f, cape->bus );
+}
+
+
+int cape_enter_bootloader_r( cape_t *cape )
 {
     unsigned char b;
     int rc = 2;
     
-    if ( register_write( REG_CONTROL, CONTROL_BOOTLOAD ) == 0 )
+    pthread_mutex_lock( &cape->lock );
+    if ( register_write( cape, REG_CONTROL, CONTROL_BOOTLOAD ) == 0 )
     {
-        if ( register_read( REG_CONTROL, &b ) == 0 )
+        if ( register_read( cape, REG_CONTROL, &b ) == 0 )
         {
             fprintf( stderr, "Unable to switch to cape bootloader\n" );
             rc = 3;
@@ -172,20 +310,224 @@ int cape_enter_bootloader( void )
             rc = 0;
         }
     }
+    pthread_mutex_unlock( &cape->lock );
+
+    // the bootloader owns the bus now; nothing cached is current
+    cache_invalidate( cape, 0, NUM_REGISTERS );
     
     return rc;
 }
 
 
-int cape_read_rtc( time_t *iptr )
+// A cached register is usable while its ttl lasts, or when the read that
+// filled it started after the caller asked (a read in flight is shared)
+static int cache_fresh( cape_cache *cache, int reg, long long now, long long asked )
+{
+    if ( !cache->valid[ reg ] )
+    {
+        return 0;
+    }
+
+    return cache->ttl_ms[ reg ] == CAPE_CACHE_FOREVER ||
+           now - cache->stamp[ reg ] < cache->ttl_ms[ reg ] * 1000000LL ||
+           cache->stamp[ reg ] > asked;
+}
+
+
+int cape_snapshot_range_r( cape_t *cape, cape_registers *regs, unsigned char first, unsigned char count )
+{
+    cape_cache *cache = &cape->cache;
+    cape_registers fresh;
+    long long asked = now_ns();
+    long long started;
+    unsigned int generation;
+    int lo, hi, i;
+    int rc = -1;
+
+    if ( ( first + count ) > NUM_REGISTERS || count == 0 )
+    {
+        fprintf( stderr, "Register range %d+%d is out of range\n", first, count );
+        return rc;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    while ( 1 )
+    {
+        long long now = now_ns();
+
+        // smallest span covering the registers that need the bus
+        lo = -1;
+        hi = -1;
+        for ( i = first; i < first + count; i++ )
+        {
+            if ( !cache_fresh( cache, i, now, asked ) )
+            {
+                if ( lo < 0 )
+                    lo = i;
+                hi = i;
+            }
+        }
+
+        if ( lo < 0 )
+        {
+            memcpy( &regs->reg[ first ], &cache->regs.reg[ first ], count );
+            pthread_mutex_unlock( &cache->lock );
+            return 0;
+        }
+
+        if ( !cache->in_flight )
+            break;
+
+        // another thread is on the bus; its result may be all we need
+        pthread_cond_wait( &cache->done, &cache->lock );
+    }
+    cache->in_flight = 1;
+    generation = cache->generation;
+    pthread_mutex_unlock( &cache->lock );
+
+    started = now_ns();
+
+    // the avr auto-increments its register index, so one write of the
+    // starting index followed by a single read returns the whole range
+    pthread_mutex_lock( &cape->lock );
+    if ( register_block_read( cape, lo, &fresh.reg[ lo ], hi - lo + 1 ) == 0 )
+    {
+        rc = 0;
+    }
+    pthread_mutex_unlock( &cape->lock );
+
+    pthread_mutex_lock( &cache->lock );
+    if ( rc == 0 )
+    {
+        // registers outside the span were fresh when checked above
+        memcpy( &regs->reg[ first ], &cache->regs.reg[ first ], count );
+        memcpy( &regs->reg[ lo ], &fresh.reg[ lo ], hi - lo + 1 );
+
+        if ( generation == cache->generation )
+        {
+            memcpy( &cache->regs.reg[ lo ], &fresh.reg[ lo ], hi - lo + 1 );
+            for ( i = lo; i <= hi; i++ )
+            {
+                cache->valid[ i ] = 1;
+                cache->stamp[ i ] = started;
+            }
+        }
+    }
+    cache->in_flight = 0;
+    pthread_cond_broadcast( &cache->done );
+    pthread_mutex_unlock( &cache->lock );
+
+    return rc;
+}
+
+
+int cape_cache_ttl_r( cape_t *cape, unsigned char reg, int ttl_ms )
+{
+    if ( reg >= NUM_REGISTERS )
+    {
+        fprintf( stderr, "Register %d is out of range\n", reg );
+        return -1;
+    }
+
+    pthread_mutex_lock( &cape->cache.lock );
+    cape->cache.ttl_ms[ reg ] = ttl_ms;
+    pthread_mutex_unlock( &cape->cache.lock );
+
+    return 0;
+}
+
+
+void cape_cache_invalidate_r( cape_t *cape )
+{
+    cache_invalidate( cape, 0, NUM_REGISTERS );
+}
+
+
+int cape_snapshot_r( cape_t *cape, cape_registers *regs )
+{
+    return cape_snapshot_range_r( cape, regs, 0, NUM_REGISTERS );
+}
+
+
+unsigned int cape_snapshot_seconds( const cape_registers *regs )
+{
+    return (unsigned int)regs->reg[ REG_SECONDS_0 ] |
+           (unsigned int)regs->reg[ REG_SECONDS_1 ] << 8 |
+           (unsigned int)regs->reg[ REG_SECONDS_2 ] << 16 |
+           (unsigned int)regs->reg[ REG_SECONDS_3 ] << 24;
+}
+
+
+int cape_snapshot_capability( const cape_registers *regs )
+{
+    int capability = -1;
+
+    if ( regs->reg[ REG_EXTENDED ] == 0x69 )
+    {
+        capability = regs->reg[ REG_CAPABILITY ];
+    }
+
+    return capability;
+}
+
+
+// Board type name, with the revision and stepping letters as printable
+// characters: an unprogrammed or non-ASCII eeprom byte comes back as '?'
+const char *cape_snapshot_board( const cape_registers *regs, unsigned char *revision, unsigned char *stepping )
+{
+    unsigned char type = regs->reg[ REG_BOARD_TYPE ];
+
+    *revision = '?';
+    *stepping = '?';
+    if ( cape_snapshot_capability( regs ) < CAPABILITY_WDT )
+    {
+        return "Unknown";
+    }
+
+    if ( regs->reg[ REG_BOARD_REV ] > 32 && regs->reg[ REG_BOARD_REV ] < 127 ) *revision = regs->reg[ REG_BOARD_REV ];
+    if ( regs->reg[ REG_BOARD_STEP ] > 32 && regs->reg[ REG_BOARD_STEP ] < 127 ) *stepping = regs->reg[ REG_BOARD_STEP ];
+
+    return type == BOARD_TYPE_BONE ? "BeagleBone" : type == BOARD_TYPE_PI ? "Raspberry Pi" : "Unknown";
+}
+
+
+// Charge current and timer are settable from board A2 on
+int cape_snapshot_has_charge( const cape_registers *regs )
+{
+    unsigned char revision, stepping;
+
+    cape_snapshot_board( regs, &revision, &stepping );
+    return cape_snapshot_capability( regs ) >= CAPABILITY_CHARGE &&
+           ( ( revision == 'A' && stepping >= '2' ) || revision > 'A' );
+}
+
+
+// A register's value from a snapshot, wider registers little endian
+unsigned long cape_snapshot_value( const cape_registers *regs, const cape_register_desc *desc )
+{
+    unsigned long value = 0;
+    int i;
+
+    for ( i = desc->width - 1; i >= 0; i-- )
+    {
+        value = ( value << 8 ) | regs->reg[ desc->first + i ];
+    }
+
+    return value;
+}
+
+
+int cape_read_rtc_r( cape_t *cape, time_t *iptr )
 {
     int rc = 1;
-    unsigned int seconds;
+    cape_registers regs;
+    time_t seconds;
     
-    if ( register32_read( REG_SECONDS_0, &seconds ) == 0 )
+    if ( cape_snapshot_range_r( cape, &regs, REG_SECONDS_0, 4 ) == 0 )
     {
+        seconds = cape_snapshot_seconds( &regs );
         //printf( "Cape RTC seconds %08X (%d)\n", seconds, seconds );
-        printf( ctime( (time_t*)&seconds ) );
+        printf( "%s", ctime( &seconds ) );
         
         if ( iptr != NULL )
         {
@@ -198,37 +540,215 @@ int cape_read_rtc( time_t *iptr )
 }
 
 
-int cape_write_rtc( void )
+// The RTC for setting the clock at boot: one read of REG_SECONDS_0..3 and
+// REG_EXTENDED straight from the bus, the marker showing the count is a
+// clock rather than an uptime. A tick landing after the low byte was read
+// carries into the bytes read after it, which only matters when the low
+// byte was 0xFF; then a second read settles it, its low byte moving on
+// only if the tick came during the first.
+int cape_boot_seconds_r( cape_t *cape, time_t *seconds )
+{
+    unsigned char buf[ REG_EXTENDED - REG_SECONDS_0 + 1 ];
+    unsigned char again[ sizeof( buf ) ];
+    int rc;
+
+    pthread_mutex_lock( &cape->lock );
+    rc = register_block_read( cape, REG_SECONDS_0, buf, sizeof( buf ) );
+    if ( rc == 0 && buf[ 0 ] == 0xFF &&
+         register_block_read( cape, REG_SECONDS_0, again, sizeof( again ) ) == 0 && again[ 0 ] != 0xFF )
+    {
+        memcpy( buf, again, sizeof( buf ) );
+    }
+    pthread_mutex_unlock( &cape->lock );
+
+    if ( rc != 0 )
+    {
+        return 1;
+    }
+
+    if ( buf[ REG_EXTENDED - REG_SECONDS_0 ] != 0x69 )
+    {
+        fprintf( stderr, "Cape firmware has no RTC\n" );
+        return 1;
+    }
+
+    *seconds = (time_t)( buf[ 0 ] | buf[ 1 ] << 8 | buf[ 2 ] << 16 | (unsigned int)buf[ 3 ] << 24 );
+    return 0;
+}
+
+
+int cape_write_rtc_r( cape_t *cape )
 {
     int rc = 1;
-    unsigned int seconds = time( NULL );
+    time_t seconds = time( NULL );
     
     //printf( "System seconds %08X (%d)\n", seconds, seconds );
-    printf( ctime( (time_t*)&seconds ) );
+    printf( "%s", ctime( &seconds ) );
 
-    if ( register32_write( REG_SECONDS_0, seconds ) == 0 )
+    pthread_mutex_lock( &cape->lock );
+    if ( register32_write( cape, REG_SECONDS_0, (unsigned int)seconds ) == 0 )
     {
         rc = 0;
     }
+    pthread_mutex_unlock( &cape->lock );
     
     return rc;
 }
 
 
-int cape_query_reason_power_on( void )
+// Wait for the cape rtc to tick, polling REG_SECONDS_* straight from the
+// bus. Returns the new count and the CLOCK_MONOTONIC time of the tick,
+// taken halfway between the last read before it and the first after.
+static int rtc_edge( cape_t *cape, unsigned int *value, long long *edge_ns )
 {
-    int rc = 1;
-    unsigned char reason;
+    unsigned char bite[ 4 ], first = 0;
+    long long before, after, last_mid = 0;
+    long long deadline = now_ns() + 1500000000LL;
+    int rc;
 
-    if ( register_read( REG_START_REASON, &reason) == 0 )
+    while ( now_ns() < deadline )
     {
-        switch ( reason ) {
-        case 1: printf("BUTTON\n"); break;
-        case 2: printf("OPTO\n"); break;
-        case 4: printf("PGOOD\n"); break;
-        case 8: printf("TIMEOUT\n"); break;
-        default: printf("CODE %d\n", reason); break;
+        pthread_mutex_lock( &cape->lock );
+        before = now_ns();
+        rc = register_block_read( cape, REG_SECONDS_0, bite, 1 );
+        after = now_ns();
+        pthread_mutex_unlock( &cape->lock );
+        if ( rc != 0 )
+        {
+            return -1;
+        }
+
+        if ( last_mid != 0 && bite[ 0 ] != first )
+        {
+            *edge_ns = ( last_mid + ( before + after ) / 2 ) / 2;
+
+            // nearly a second before the next tick, so all four bytes agree
+            pthread_mutex_lock( &cape->lock );
+            rc = register_block_read( cape, REG_SECONDS_0, bite, 4 );
+            pthread_mutex_unlock( &cape->lock );
+
+            *value = bite[ 0 ] | ( bite[ 1 ] << 8 ) | ( bite[ 2 ] << 16 ) | ( (unsigned int)bite[ 3 ] << 24 );
+            return rc;
         }
+
+        first = bite[ 0 ];
+        last_mid = ( before + after ) / 2;
+        usleep( RTC_POLL_US );
+    }
+
+    fprintf( stderr, "Cape RTC is not ticking\n" );
+    return -1;
+}
+
+
+// Cape time to within a few ms, as of the return: waits up to a second
+// for the rtc to tick and counts from the tick
+int cape_rtc_now_r( cape_t *cape, struct timespec *ts )
+{
+    unsigned int value;
+    long long edge, since;
+
+    if ( rtc_edge( cape, &value, &edge ) != 0 )
+    {
+        return 1;
+    }
+
+    since = now_ns() - edge;
+    ts->tv_sec = value + since / 1000000000;
+    ts->tv_nsec = since % 1000000000;
+
+    return 0;
+}
+
+
+int cape_read_rtc_sync_r( cape_t *cape, struct timespec *ts )
+{
+    if ( cape_rtc_now_r( cape, ts ) != 0 )
+    {
+        return 1;
+    }
+
+    printf( "%s", ctime( &ts->tv_sec ) );
+    return 0;
+}
+
+
+// Write the system time so the cape's second starts with the system's.
+// Firmware with CAPABILITY_RTC_SYNC restarts its second on the write of
+// REG_SECONDS_0, so the write is made at a system second boundary. Older
+// firmware keeps its tick phase, so the write follows a tick and rounds to
+// the nearest second; offset_us returns how far the cape's ticks then sit
+// from the system's seconds (up to half a second).
+int cape_write_rtc_sync_r( cape_t *cape, long *offset_us )
+{
+    cape_registers regs;
+    struct timespec mono, real, next;
+    time_t seconds;
+    long long edge, edge_real;
+    unsigned int value;
+    int rc;
+
+    if ( cape_snapshot_range_r( cape, &regs, REG_EXTENDED, 2 ) != 0 )
+    {
+        return 1;
+    }
+
+    if ( cape_snapshot_capability( &regs ) >= CAPABILITY_RTC_SYNC )
+    {
+        clock_gettime( CLOCK_REALTIME, &next );
+        next.tv_sec++;
+        next.tv_nsec = 0;
+        while ( clock_nanosleep( CLOCK_REALTIME, TIMER_ABSTIME, &next, NULL ) == EINTR )
+            ;
+        seconds = next.tv_sec;
+        *offset_us = 0;
+    }
+    else
+    {
+        if ( rtc_edge( cape, &value, &edge ) != 0 )
+        {
+            return 1;
+        }
+
+        // system time at the tick
+        clock_gettime( CLOCK_MONOTONIC, &mono );
+        clock_gettime( CLOCK_REALTIME, &real );
+        edge_real = (long long)real.tv_sec * 1000000000 + real.tv_nsec -
+                    ( (long long)mono.tv_sec * 1000000000 + mono.tv_nsec - edge );
+
+        seconds = ( edge_real + 500000000 ) / 1000000000;
+        *offset_us = ( edge_real - (long long)seconds * 1000000000 ) / 1000;
+    }
+
+    pthread_mutex_lock( &cape->lock );
+    rc = register32_write( cape, REG_SECONDS_0, (unsigned int)seconds );
+    pthread_mutex_unlock( &cape->lock );
+    printf( "%s", ctime( &seconds ) );
+
+    return rc == 0 ? 0 : 1;
+}
+
+
+void cape_print_reason_power_on( const cape_registers *regs )
+{
+    switch ( regs->reg[ REG_START_REASON ] ) {
+    case 1: printf("BUTTON\n"); break;
+    case 2: printf("OPTO\n"); break;
+    case 4: printf("PGOOD\n"); break;
+    case 8: printf("TIMEOUT\n"); break;
+    default: printf("CODE %d\n", regs->reg[ REG_START_REASON ]); break;
+    }
+}
+
+
+int cape_query_reason_power_on_r( cape_t *cape )
+{
+    int rc = 1;
+    cape_registers regs;
+
+    if ( cape_snapshot_range_r( cape, &regs, REG_START_REASON, 1 ) == 0 )
+    {
+        cape_print_reason_power_on( &regs );
         rc = 0;
     }
 
@@ -236,137 +756,308 @@ int cape_query_reason_power_on( void )
 }
 
 
-int cape_show_cape_info( void )
+void cape_print_info( const cape_registers *regs )
 {
     unsigned char c;
     unsigned char c1, c2, c3, c4;
-    unsigned char revision, stepping, type;
-    char capability = -1;
+    unsigned char revision, stepping;
+    const char *board;
+    int capability = cape_snapshot_capability( regs );
+    int i;
+
+    c = regs->reg[ REG_CONTROL ];
+    if ( ! (c & CONTROL_CE) ) printf("Charger is not enabled!\n");
+    if ( c & CONTROL_BOOTLOAD ) printf("Bootloader is enabled!\n");
+    printf("LED 1 %s, LED 2 %s\n",
+	    c & CONTROL_LED0 ? "on" : "off",
+	    c & CONTROL_LED1 ? "on" : "off");
 
-    if ( register_read(REG_EXTENDED, &c) == 0 && c == 0x69 )
+    c = regs->reg[ REG_START_REASON ];
+    printf("Powered on triggered by ");
+    if ( c & START_BUTTON ) printf("button press ");
+    if ( c & START_EXTERNAL ) printf("external event ");
+    if ( c & START_PWRGOOD ) printf("power good ");
+    if ( c & START_TIMEOUT ) printf("timer");
+    printf("\n");
+
+    if ( capability >= CAPABILITY_WDT )
     {
-        if ( register_read(REG_CAPABILITY, &capability) != 0 )
-	{
-	    capability = -1;
-	}
+        board = cape_snapshot_board( regs, &revision, &stepping );
+        printf("%s PowerCape %c%c\n", board, revision, stepping);
+
+        c1 = regs->reg[ REG_WDT_RESET ];
+        c2 = regs->reg[ REG_WDT_POWER ];
+        c3 = regs->reg[ REG_WDT_STOP ];
+        c4 = regs->reg[ REG_WDT_START ];
+        printf("Watchdog: power cycle @ %d, power down @ %d, start within @ %d, reset for %d\n", c2, c3, c4, c1);
     }
 
-    if ( register_read(REG_CONTROL, &c) == 0 )
+    if ( capability >= CAPABILITY_RTC ) 
     {
-	if ( ! (c & CONTROL_CE) ) printf("Charger is not enabled!\n");
-	if ( c & CONTROL_BOOTLOAD ) printf("Bootloader is enabled!\n");
-	printf("LED 1 %s, LED 2 %s\n",
-		c & CONTROL_LED0 ? "on" : "off",
-		c & CONTROL_LED1 ? "on" : "off");
+	time_t seconds = cape_snapshot_seconds( regs );
+	printf("RTC: %s", ctime(&seconds));
     }
 
-    if ( register_read(REG_START_REASON, &c) == 0 )
+    c = regs->reg[ REG_START_ENABLE ];
+    printf("Allow power on by ");
+    if ( c & START_BUTTON ) printf("button press; ");
+    if ( c & START_EXTERNAL ) printf("external event; ");
+    if ( c & START_PWRGOOD ) printf("power good signal; ");
+    if ( c & START_TIMEOUT ) 
     {
-        printf("Powered on triggered by ");
-	if ( c & START_BUTTON ) printf("button press ");
-	if ( c & START_EXTERNAL ) printf("external event ");
-	if ( c & START_PWRGOOD ) printf("power good ");
-	if ( c & START_TIMEOUT ) printf("timer");
-        printf("\n");
+        unsigned char hours = regs->reg[ REG_RESTART_HOURS ];
+        unsigned char minutes = regs->reg[ REG_RESTART_MINUTES ];
+        unsigned char seconds = regs->reg[ REG_RESTART_SECONDS ];
+
+        if ( seconds > 0 ) {
+            printf("%d seconds power off", hours * 3600 + minutes * 60 + seconds);
+        }
+        else if ( minutes > 0 )
+        {
+            printf("%d minutes power off", hours * 60 + minutes);
+        }
+        else
+        {
+            printf("%d hours power off", hours);
+        }
     }
+    printf("\n");
 
-    if ( capability >= CAPABILITY_WDT )
+    c = regs->reg[ REG_STATUS ];
+    if ( c & STATUS_BUTTON ) printf("Button PRESSED\n");
+    if ( c & STATUS_OPTO ) printf("Opto ACTIVE\n");
+    // if ( c & STATUS_POWER_GOOD ) printf("Power good\n");
+
+    if ( capability >= CAPABILITY_ADDR )
     {
-        if ( register_read( REG_BOARD_TYPE, &type) == 0 && 
-             register_read( REG_BOARD_REV, &revision ) == 0 && 
-             register_read( REG_BOARD_STEP, &stepping ) == 0 )
+        printf("AVR I2C address: 0x%02x\n", regs->reg[ REG_I2C_ADDRESS ]);
+    }
+
+    // printf("AVR MCURS: 0x%02x, OSCCAL: 0x%02x\n",
+    //     regs->reg[ REG_MCUSR ], regs->reg[ REG_OSCCAL ]);
+
+    if ( cape_snapshot_has_charge( regs ) )
+    {
+        c1 = regs->reg[ REG_I2C_ICHARGE ];
+        c2 = regs->reg[ REG_I2C_TCHARGE ];
+        printf("Charge current: %d mA\n", c1 * 1000 / 3);
+        printf("Charge timer: %d hours\n", c2);
+    }
+
+    // registers the map marks to show, rather than decoded above
+    for ( i = 0; i < cape_register_count; i++ )
+    {
+        const cape_register_desc *desc = &cape_register_map[ i ];
+
+        if ( ( desc->flags & REG_FLAG_SHOW ) && capability >= desc->capability )
         {
-            if ( revision <= 32 || revision >= 127 ) revision = '?';
-            if ( stepping <= 32 || stepping >= 127 ) stepping = '?';
-            printf("%s PowerCape %c%c\n", 
-		type == BOARD_TYPE_BONE ? "BeagleBone" : 
-		    type == BOARD_TYPE_PI ? "Raspberry Pi" : "Unknown", 
-		revision, 
-		stepping);
+            printf( desc->flags & REG_FLAG_HEX ? "%s: 0x%02lx\n" : "%s: %lu\n",
+                    desc->comment, cape_snapshot_value( regs, desc ) );
         }
+    }
+}
+
+
+static const char *json_bool( int b )
+{
+    return b ? "true" : "false";
+}
+
 
-        if ( register_read(REG_WDT_RESET, &c1) == 0 && 
-             register_read(REG_WDT_POWER, &c2) == 0 && 
-             register_read(REG_WDT_STOP, &c3) == 0 && 
-             register_read(REG_WDT_START, &c4) == 0 )
+static void json_start_flags( FILE *f, const char *name, unsigned char c )
+{
+    fprintf( f, "  \"%s\": { \"button\": %s, \"external\": %s, \"power_good\": %s, \"timeout\": %s",
+             name, json_bool( c & START_BUTTON ), json_bool( c & START_EXTERNAL ),
+             json_bool( c & START_PWRGOOD ), json_bool( c & START_TIMEOUT ) );
+}
+
+
+// The snapshot as one JSON object, decoded as cape_print_info() does; the
+// raw register file comes along for anything not decoded
+void cape_print_json( FILE *f, const cape_registers *regs )
+{
+    unsigned char c = regs->reg[ REG_CONTROL ];
+    unsigned char revision, stepping;
+    int capability = cape_snapshot_capability( regs );
+    int i;
+
+    fprintf( f, "{\n  \"registers\": [" );
+    for ( i = 0; i < NUM_REGISTERS; i++ )
+    {
+        fprintf( f, "%s%d", i ? ", " : " ", regs->reg[ i ] );
+    }
+    fprintf( f, " ],\n  \"capability\": %d,\n", capability );
+
+    fprintf( f, "  \"control\": { \"charger_enabled\": %s, \"bootloader\": %s, \"led1\": %s, \"led2\": %s },\n",
+             json_bool( c & CONTROL_CE ), json_bool( c & CONTROL_BOOTLOAD ),
+             json_bool( c & CONTROL_LED0 ), json_bool( c & CONTROL_LED1 ) );
+
+    c = regs->reg[ REG_STATUS ];
+    fprintf( f, "  \"status\": { \"power_good\": %s, \"button\": %s, \"opto\": %s },\n",
+             json_bool( c & STATUS_POWER_GOOD ), json_bool( c & STATUS_BUTTON ), json_bool( c & STATUS_OPTO ) );
+
+    json_start_flags( f, "start_reason", regs->reg[ REG_START_REASON ] );
+    fprintf( f, " },\n" );
+    json_start_flags( f, "start_enable", regs->reg[ REG_START_ENABLE ] );
+    fprintf( f, ", \"restart_seconds\": %d },\n",
+             regs->reg[ REG_RESTART_HOURS ] * 3600 + regs->reg[ REG_RESTART_MINUTES ] * 60 +
+             regs->reg[ REG_RESTART_SECONDS ] );
+
+    if ( capability >= CAPABILITY_WDT )
+    {
+        const char *board = cape_snapshot_board( regs, &revision, &stepping );
+
+        fprintf( f, "  \"board\": { \"type\": \"%s\", \"revision\": \"%c\", \"stepping\": \"%c\" },\n",
+                 board, revision, stepping );
+        fprintf( f, "  \"watchdog\": { \"reset\": %d, \"power\": %d, \"stop\": %d, \"start\": %d },\n",
+                 regs->reg[ REG_WDT_RESET ], regs->reg[ REG_WDT_POWER ],
+                 regs->reg[ REG_WDT_STOP ], regs->reg[ REG_WDT_START ] );
+    }
+
+    if ( capability >= CAPABILITY_ADDR )
+    {
+        fprintf( f, "  \"i2c_address\": %d,\n", regs->reg[ REG_I2C_ADDRESS ] );
+    }
+
+    if ( cape_snapshot_has_charge( regs ) )
+    {
+        fprintf( f, "  \"charge\": { \"current_ma\": %d, \"timer_hours\": %d },\n",
+                 regs->reg[ REG_I2C_ICHARGE ] * 1000 / 3, regs->reg[ REG_I2C_TCHARGE ] );
+    }
+
+    for ( i = 0; i < cape_register_count; i++ )
+    {
+        const cape_register_desc *desc = &cape_register_map[ i ];
+
+        if ( ( desc->flags & REG_FLAG_SHOW ) && capability >= desc->capability )
         {
-            printf("Watchdog: power cycle @ %d, power down @ %d, start within @ %d, reset for %d\n", c2, c3, c4, c1);
+            fprintf( f, "  \"%s\": %lu,\n", desc->name, cape_snapshot_value( regs, desc ) );
         }
     }
 
-    if ( capability >= CAPABILITY_RTC ) 
+    // last, so every member above can end with a comma
+    if ( capability >= CAPABILITY_RTC )
     {
-	unsigned int seconds;
-	if ( register32_read(REG_SECONDS_0, &seconds) == 0 )
-	{
-	    printf("RTC: %s", ctime((time_t*)&seconds));
-	}
-    }
-
-    if ( register_read(REG_START_ENABLE, &c) == 0 )
-    {
-        printf("Allow power on by ");
-	if ( c & START_BUTTON ) printf("button press; ");
-	if ( c & START_EXTERNAL ) printf("external event; ");
-	if ( c & START_PWRGOOD ) printf("power good signal; ");
-	if ( c & START_TIMEOUT ) 
-	{
-            unsigned char hours, minutes, seconds;
-            if ( register_read(REG_RESTART_HOURS , &hours) == 0 && 
-                 register_read(REG_RESTART_MINUTES , &minutes) == 0 && 
-                 register_read(REG_RESTART_SECONDS , &seconds) == 0 )
-            {
-                if ( seconds > 0 ) {
-                    printf("%d seconds power off", hours * 3600 + minutes * 60 + seconds);
-                }
-                else if ( minutes > 0 )
-                {
-                    printf("%d minutes power off", hours * 60 + minutes);
-                }
-                else
-                {
-                    printf("%d hours power off", hours);
-                }
-            }
+        fprintf( f, "  \"rtc\": %u\n}", cape_snapshot_seconds( regs ) );
+    }
+    else
+    {
+        fprintf( f, "  \"rtc\": null\n}" );
+    }
+}
 
-        }
-	printf("\n");
+
+int cape_show_cape_info_r( cape_t *cape )
+{
+    int rc = 1;
+    cape_registers regs;
+
+    if ( cape_snapshot_r( cape, &regs ) == 0 )
+    {
+        cape_print_info( &regs );
+        rc = 0;
     }
 
-    if ( register_read(REG_STATUS, &c) == 0 )
+    return rc;
+}
+
+
+int cape_register_write_r( cape_t *cape, unsigned char reg, unsigned char data )
+{
+    int rc;
+
+    pthread_mutex_lock( &cape->lock );
+    rc = register_write( cape, reg, data );
+    pthread_mutex_unlock( &cape->lock );
+
+    return rc;
+}
+
+
+int cape_register_block_write_r( cape_t *cape, unsigned char reg, const unsigned char *data, int len )
+{
+    int rc;
+
+    pthread_mutex_lock( &cape->lock );
+    rc = register_block_write( cape, reg, data, len );
+    pthread_mutex_unlock( &cape->lock );
+
+    return rc;
+}
+
+
+void cape_batch_init( cape_batch *batch )
+{
+    memset( batch, 0, sizeof( cape_batch ) );
+}
+
+
+int cape_batch_set( cape_batch *batch, unsigned char reg, unsigned char value )
+{
+    if ( reg >= NUM_REGISTERS )
     {
-	if ( c & STATUS_BUTTON ) printf("Button PRESSED\n");
-	if ( c & STATUS_OPTO ) printf("Opto ACTIVE\n");
-	// if ( c & STATUS_POWER_GOOD ) printf("Power good\n");
+        fprintf( stderr, "Register %d is out of range\n", reg );
+        return -1;
     }
 
-    if ( capability >= CAPABILITY_ADDR )
+    batch->value[ reg ] = value;
+    batch->pending[ reg ] = 1;
+    return 0;
+}
+
+
+// Drop pending registers that already hold their value in current,
+// returning how many are left to write
+int cape_batch_diff( cape_batch *batch, const cape_registers *current )
+{
+    int changed = 0;
+    int i;
+
+    for ( i = 0; i < NUM_REGISTERS; i++ )
     {
-        if ( register_read(REG_I2C_ADDRESS, &c) == 0 )
+        if ( batch->pending[ i ] && batch->value[ i ] == current->reg[ i ] )
         {
-            printf("AVR I2C address: 0x%02x\n", c);
+            batch->pending[ i ] = 0;
         }
+        changed += batch->pending[ i ];
     }
 
-    // if ( register_read(REG_MCUSR, &c1) == 0 && 
-    //      register_read(REG_OSCCAL, &c2) == 0 )
-    // {
-    //     printf("AVR MCURS: 0x%02x, OSCCAL: 0x%02x\n", c1, c2);
-    // }
+    return changed;
+}
+
+
+// Write every pending register, one auto-increment burst per run of
+// adjacent registers, holding the handle for the whole batch
+int cape_batch_commit_r( cape_t *cape, cape_batch *batch )
+{
+    int rc = 0;
+    int first, last;
 
-    if ( capability >= CAPABILITY_CHARGE && (revision == 'A' && stepping >= '2' || revision > 'A') )
+    pthread_mutex_lock( &cape->lock );
+    for ( first = 0; first < NUM_REGISTERS && rc == 0; first = last )
     {
-        if ( register_read(REG_I2C_ICHARGE, &c1) == 0 && register_read(REG_I2C_TCHARGE, &c2) == 0 )
+        if ( !batch->pending[ first ] )
         {
-	    printf("Charge current: %d mA\n", c1 * 1000 / 3);
-	    printf("Charge timer: %d hours\n", c2);
+            last = first + 1;
+            continue;
+        }
+
+        for ( last = first; last < NUM_REGISTERS && batch->pending[ last ]; last++ )
+            ;
+
+        rc = register_block_write( cape, first, &batch->value[ first ], last - first );
+        if ( rc == 0 )
+        {
+            memset( &batch->pending[ first ], 0, last - first );
         }
     }
+    pthread_mutex_unlock( &cape->lock );
 
-    return 0;
+    return rc;
 }
 
-int cape_charge_rate(unsigned char rate)
+
+int cape_charge_rate_r(cape_t *cape, unsigned char rate)
 {
     //TODO: add in capability checks as done in show info
      int rc = 0;
@@ -374,7 +1065,7 @@ int cape_charge_rate(unsigned char rate)
          (rate == CHARGE_RATE_MED) ||
          (rate == CHARGE_RATE_HIGH))
      {
-         rc = register_write(REG_I2C_ICHARGE, rate);
+         rc = cape_register_write_r(cape, REG_I2C_ICHARGE, rate);
      }
      else
      {
@@ -384,12 +1075,12 @@ int cape_charge_rate(unsigned char rate)
      return rc;
 }
 
-int cape_charge_time(unsigned char time)
+int cape_charge_time_r(cape_t *cape, unsigned char time)
 {
     int rc = 0;
     if ((time >= CHARGE_RATE_LOW) && (time <= CHARGE_TIME_MAX))
     {
-        rc = register_write(REG_I2C_TCHARGE, time);
+        rc = cape_register_write_r(cape, REG_I2C_TCHARGE, time);
     }
     else
     {
@@ -398,12 +1089,12 @@ int cape_charge_time(unsigned char time)
     return rc;
 }
 
-int cape_power_down(unsigned char seconds)
+int cape_power_down_r(cape_t *cape, unsigned char seconds)
 {
     int rc = 0;
     if ((seconds >= POWER_DOWN_MIN_SEC) && (seconds <= POWER_DOWN_MAX_SEC))
     {
-        rc = register_write(REG_WDT_STOP, seconds);
+        rc = cape_register_write_r(cape, REG_WDT_STOP, seconds);
     }
     else
     {
@@ -412,30 +1103,188 @@ int cape_power_down(unsigned char seconds)
     return rc;
 }
 
-int cape_power_on(int seconds)
+// Countdown registers for a power on seconds after power off
+static void countdown_batch( cape_batch *batch, int seconds )
+{
+    cape_batch_set( batch, REG_RESTART_HOURS, seconds / 3600 );
+    cape_batch_set( batch, REG_RESTART_MINUTES, ( seconds % 3600 ) / 60 );
+    cape_batch_set( batch, REG_RESTART_SECONDS, seconds % 60 );
+}
+
+
+int cape_power_on_r(cape_t *cape, int seconds)
 {
     int rc = 0;
+    cape_batch batch;
     if ((seconds >= POWER_ON_MIN_SEC) && (seconds <= POWER_ON_MAX_SEC))
     {
-        // convert to hours, minutes, seconds
-        unsigned char hour = (unsigned char) seconds / 3600;
-        unsigned char min = (unsigned char) (seconds % 3600) / 60;
-        unsigned char sec = (unsigned char) (seconds % 60);
+        // one transaction, so no other bus user sees the countdown half written
+        cape_batch_init(&batch);
+        countdown_batch(&batch, seconds);
+        rc = cape_batch_commit_r(cape, &batch);
+    }
+    else
+    {
+        fprintf(stderr, "Power on seconds %d is out of range\n", seconds);
+    }
+    return rc;
+}
 
-        rc = register_write(REG_RESTART_HOURS, hour);
-        if (rc != -1)
-        {
-            rc = register_write(REG_RESTART_MINUTES, min);
-        }
-        if (rc != -1)
+
+// Power on at when, in seconds on the cape rtc. The firmware starts the
+// countdown when it powers the board off: power_down seconds from now if
+// nonzero (REG_WDT_STOP is armed here), otherwise at the next shutdown,
+// which must then follow promptly. The registers are read back after.
+int cape_wake_at_r( cape_t *cape, time_t when, unsigned char power_down )
+{
+    cape_registers regs;
+    cape_batch batch;
+    long long countdown;
+    unsigned char stop;
+    int i;
+
+    // the rtc must be current, not up to a cache ttl old
+    cache_invalidate( cape, REG_SECONDS_0, 4 );
+    if ( cape_snapshot_range_r( cape, &regs, REG_SECONDS_0, 4 ) != 0 )
+    {
+        return -1;
+    }
+
+    countdown = (long long)when - cape_snapshot_seconds( &regs ) - power_down;
+    if ( countdown < 1 || countdown > POWER_ON_MAX_SEC )
+    {
+        fprintf( stderr, "Wake time is %lld seconds after power off, must be 1 to %d\n",
+                 countdown, POWER_ON_MAX_SEC );
+        return -1;
+    }
+
+    // countdown first, so the board never goes down without it
+    cape_batch_init( &batch );
+    countdown_batch( &batch, (int)countdown );
+    if ( cape_batch_commit_r( cape, &batch ) != 0 ||
+         ( power_down && cape_register_write_r( cape, REG_WDT_STOP, power_down ) != 0 ) )
+    {
+        return -1;
+    }
+
+    if ( cape_snapshot_range_r( cape, &regs, REG_START_ENABLE, REG_WDT_STOP - REG_START_ENABLE + 1 ) != 0 )
+    {
+        return -1;
+    }
+
+    for ( i = REG_RESTART_HOURS; i <= REG_RESTART_SECONDS; i++ )
+    {
+        if ( regs.reg[ i ] != batch.value[ i ] )
         {
-            rc = register_write(REG_RESTART_SECONDS, sec);
+            fprintf( stderr, "Countdown reads back as %d:%02d:%02d\n", regs.reg[ REG_RESTART_HOURS ],
+                     regs.reg[ REG_RESTART_MINUTES ], regs.reg[ REG_RESTART_SECONDS ] );
+            return -1;
         }
     }
-    else
+    if ( !( regs.reg[ REG_START_ENABLE ] & START_TIMEOUT ) )
     {
-        fprintf(stderr, "Power on seconds %d is out of range\n", seconds);
+        fprintf( stderr, "Timer power on is not enabled\n" );
+        return -1;
+    }
+
+    // the power down countdown may have ticked once since it was written
+    stop = regs.reg[ REG_WDT_STOP ];
+    if ( power_down && ( stop > power_down || stop + 1 < power_down ) )
+    {
+        fprintf( stderr, "Power down countdown reads back as %d\n", stop );
+        return -1;
     }
+
+    return 0;
+}
+
+
+// Single-cape wrappers around the default handle
+
+int cape_initialize(int i2c_bus, int avr_address)
+{
+    pc = cape_open(i2c_bus, avr_address);
+    return pc != NULL ? 0 : -1;
+}
+
+int cape_close(void)
+{
+    int rc = cape_close_r(pc);
+    pc = NULL;
     return rc;
 }
 
+void cape_print_stats( FILE *f )
+{
+    cape_print_stats_r( pc, f );
+}
+
+int cape_enter_bootloader( void )
+{
+    return cape_enter_bootloader_r( pc );
+}
+
+int cape_snapshot_range( cape_registers *regs, unsigned char first, unsigned char count )
+{
+    return cape_snapshot_range_r( pc, regs, first, count );
+}
+
+int cape_snapshot( cape_registers *regs )
+{
+    return cape_snapshot_r( pc, regs );
+}
+
+int cape_read_rtc( time_t *iptr )
+{
+    return cape_read_rtc_r( pc, iptr );
+}
+
+int cape_write_rtc( void )
+{
+    return cape_write_rtc_r( pc );
+}
+
+int cape_read_rtc_sync( struct timespec *ts )
+{
+    return cape_read_rtc_sync_r( pc, ts );
+}
+
+int cape_write_rtc_sync( long *offset_us )
+{
+    return cape_write_rtc_sync_r( pc, offset_us );
+}
+
+int cape_query_reason_power_on( void )
+{
+    return cape_query_reason_power_on_r( pc );
+}
+
+int cape_show_cape_info( void )
+{
+    return cape_show_cape_info_r( pc );
+}
+
+int cape_charge_rate(unsigned char rate)
+{
+    return cape_charge_rate_r(pc, rate);
+}
+
+int cape_charge_time(unsigned char time)
+{
+    return cape_charge_time_r(pc, time);
+}
+
+int cape_power_down(unsigned char seconds)
+{
+    return cape_power_down_r(pc, seconds);
+}
+
+int cape_power_on(int seconds)
+{
+    return cape_power_on_r(pc, seconds);
+}
+
+int cape_wake_at(time_t when, unsigned char power_down)
+{
+    return cape_wake_at_r(pc, when, power_down);
+}
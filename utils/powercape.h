@@ -15,9 +15,16 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
+#include "transport.h"
 #include "../avr/registers.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define CAPE_I2C_BUS        0x01
 #define AVR_ADDRESS         0x21
 #define INA_ADDRESS         0x40
@@ -43,26 +50,174 @@
 #define POWER_DOWN_MAX_SEC     0xFF
 
 #define POWER_ON_MIN_SEC       0x00
-#define POWER_ON_MAX_SEC       0x21A453
-
-// structure to hold data fields needed by powercape routines
+#define POWER_ON_MAX_SEC       0x0E0FFF // 255:59:59, largest countdown the registers hold
+
+// register cache lifetimes in ms, per register; registers the firmware
+// changes itself (status, start reason, rtc, countdowns) get the volatile
+// one, the others change only when written
+#define CAPE_CACHE_TTL_MS      100
+#define CAPE_CACHE_VOLATILE_MS 10
+#define CAPE_CACHE_FOREVER     -1      // until a write or invalidate
+#define CAPE_CACHE_NEVER       0       // always read the bus
+
+// copy of the avr register file, indexed by enum registers_type
+typedef struct _cape_registers {
+    unsigned char reg[ NUM_REGISTERS ];
+} cape_registers;
+
+// a register as described in avr/registers.map, see regtable.c
+typedef struct _cape_register_desc {
+    const char *name;
+    const char *comment;
+    unsigned char first;            // enum registers_type index of the low byte
+    unsigned char width;            // bytes, little endian
+    int capability;                 // CAPABILITY_ level introducing it, -1 for all
+    unsigned char flags;            // REG_FLAG_*
+    unsigned long min;
+    unsigned long max;
+} cape_register_desc;
+
+extern const cape_register_desc cape_register_map[];
+extern const int cape_register_count;
+
+// registers read recently, shared by readers of one handle; concurrent
+// readers missing the cache wait for a single bus read instead of each
+// issuing their own
+typedef struct _cape_cache {
+    pthread_mutex_t lock;
+    pthread_cond_t done;            // signalled when a bus read finishes
+    int in_flight;
+    unsigned int generation;        // bumped by every write
+    cape_registers regs;
+    unsigned char valid[ NUM_REGISTERS ];
+    long long stamp[ NUM_REGISTERS ];   // CLOCK_MONOTONIC ns the read started
+    int ttl_ms[ NUM_REGISTERS ];
+} cape_cache;
+
+// structure to hold data fields needed by powercape routines, one per
+// cape; the lock serializes bus access from threads sharing a handle
 typedef struct _powercape {
     int i2c_bus;
-    int handle;
+    int address;
+    transport_t *bus;
+    int owns_bus;               // bus is closed with the handle
     int status;
+    pthread_mutex_t lock;
+    cape_cache cache;
 } powercape;
 
+typedef powercape cape_t;
+
+// register writes collected for cape_batch_commit_r()
+typedef struct _cape_batch {
+    unsigned char value[ NUM_REGISTERS ];
+    unsigned char pending[ NUM_REGISTERS ];
+} cape_batch;
+
+
+// Handle based interface, safe to use from several threads and for several
+// capes in one process
+
+cape_t *cape_open(int i2c_bus, int avr_address);
+
+cape_t *cape_attach(transport_t *bus, int avr_address);
+
+int cape_close_r(cape_t *cape);
+
+int cape_status_r(cape_t *cape);
+
+void cape_print_stats_r(cape_t *cape, FILE *f);
+
+int cape_snapshot_r(cape_t *cape, cape_registers *regs);
+
+int cape_snapshot_range_r(cape_t *cape, cape_registers *regs, unsigned char first, unsigned char count);
+
+int cape_register_write_r(cape_t *cape, unsigned char reg, unsigned char data);
+
+int cape_register_block_write_r(cape_t *cape, unsigned char reg, const unsigned char *data, int len);
+
+int cape_batch_commit_r(cape_t *cape, cape_batch *batch);
+
+int cape_cache_ttl_r(cape_t *cape, unsigned char reg, int ttl_ms);
+
+void cape_cache_invalidate_r(cape_t *cape);
+
+int cape_enter_bootloader_r(cape_t *cape);
+
+int cape_read_rtc_r(cape_t *cape, time_t *iptr);
+
+int cape_boot_seconds_r(cape_t *cape, time_t *seconds);
+
+int cape_write_rtc_r(cape_t *cape);
+
+int cape_rtc_now_r(cape_t *cape, struct timespec *ts);
+
+int cape_read_rtc_sync_r(cape_t *cape, struct timespec *ts);
+
+int cape_write_rtc_sync_r(cape_t *cape, long *offset_us);
+
+int cape_query_reason_power_on_r(cape_t *cape);
+
+int cape_show_cape_info_r(cape_t *cape);
+
+int cape_charge_rate_r(cape_t *cape, unsigned char rate);
+
+int cape_charge_time_r(cape_t *cape, unsigned char time);
+
+int cape_power_down_r(cape_t *cape, unsigned char seconds);
+
+int cape_power_on_r(cape_t *cape, int seconds);
+
+int cape_wake_at_r(cape_t *cape, time_t when, unsigned char power_down);
+
+// Batch building, no bus access
+
+void cape_batch_init(cape_batch *batch);
+
+int cape_batch_set(cape_batch *batch, unsigned char reg, unsigned char value);
+
+int cape_batch_diff(cape_batch *batch, const cape_registers *current);
+
+// Snapshot decoding, no bus access
+
+unsigned int cape_snapshot_seconds(const cape_registers *regs);
+
+int cape_snapshot_capability(const cape_registers *regs);
+
+const char *cape_snapshot_board(const cape_registers *regs, unsigned char *revision, unsigned char *stepping);
+
+int cape_snapshot_has_charge(const cape_registers *regs);
+
+unsigned long cape_snapshot_value(const cape_registers *regs, const cape_register_desc *desc);
+
+void cape_print_info(const cape_registers *regs);
+
+void cape_print_json(FILE *f, const cape_registers *regs);
+
+void cape_print_reason_power_on(const cape_registers *regs);
+
+// Single-cape interface operating on a default handle
 
 int cape_initialize(int i2c_bus, int avr_address);
 
 int cape_close(void);
 
+void cape_print_stats(FILE *f);
+
+int cape_snapshot(cape_registers *regs);
+
+int cape_snapshot_range(cape_registers *regs, unsigned char first, unsigned char count);
+
 int cape_enter_bootloader(void);
 
 int cape_read_rtc(time_t *iptr);
 
 int cape_write_rtc(void);
 
+int cape_read_rtc_sync(struct timespec *ts);
+
+int cape_write_rtc_sync(long *offset_us);
+
 int cape_query_reason_power_on(void);
 
 int cape_show_cape_info(void);
@@ -75,4 +230,10 @@ int cape_power_down(unsigned char seconds);
 
 int cape_power_on(int seconds);
 
+int cape_wake_at(time_t when, unsigned char power_down);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
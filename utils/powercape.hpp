@@ -0,0 +1,294 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * powercape.hpp
+ *
+ * Header-only C++17 interface to the cape over the C library. Every
+ * register has a descriptor type giving its index, width in bytes (little
+ * endian), access, the capability level that introduced it and the values
+ * it accepts, generated from avr/registers.map into powercape_regs.hpp.
+ * Reads and writes name descriptors, so the register span of a burst, the
+ * value types and the checks are worked out at compile time:
+ *
+ *     using namespace capesdk;
+ *     cape< CAPABILITY_CHARGE > c;                         // refuses older firmware
+ *     auto t = c.read< regs::seconds, regs::capability >();   // one 6 byte read
+ *     c.write< regs::charge_current, CHARGE_RATE_MED >();  // checked when compiled
+ *     c.write< regs::charge_current, 0 >();                // does not compile
+ *
+ * A cape< capability_unknown > checks capability when each call is made.
+ * Calls return 0 or std::nullopt on failure, as the C library's do.
+ */
+
+#ifndef __POWER_CAPE_HPP__
+#define __POWER_CAPE_HPP__
+#include <cstdint>
+#include <optional>
+#include <tuple>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include "powercape.h"
+
+namespace capesdk {
+
+enum class reg_access { read_only, read_write };
+
+// registers every firmware has, from before the extended set
+inline constexpr int capability_basic = -1;
+
+// target capability only known once the cape answers
+inline constexpr int capability_unknown = -2;
+
+
+template < unsigned char First, unsigned char Width, reg_access Mode, int MinCapability,
+           unsigned long Min, unsigned long Max >
+struct descriptor {
+    static_assert( Width >= 1 && Width <= 4, "registers are 1 to 4 bytes" );
+    static_assert( First + Width <= NUM_REGISTERS, "register beyond the register file" );
+    static_assert( Min <= Max && Max <= ( ~0ULL >> ( 64 - 8 * Width ) ), "range does not fit the width" );
+
+    using value_type = std::conditional_t< ( Width > 2 ), uint32_t,
+                       std::conditional_t< ( Width > 1 ), uint16_t, uint8_t > >;
+
+    static constexpr unsigned char first = First;
+    static constexpr unsigned char last = First + Width - 1;
+    static constexpr unsigned char width = Width;
+    static constexpr reg_access mode = Mode;
+    static constexpr int min_capability = MinCapability;
+    static constexpr unsigned long min = Min;
+    static constexpr unsigned long max = Max;
+
+    static constexpr bool valid( unsigned long value )
+    {
+        return value >= Min && value <= Max;
+    }
+
+    static constexpr value_type decode( const unsigned char *reg )
+    {
+        unsigned long value = 0;
+
+        for ( int i = Width - 1; i >= 0; i-- )
+        {
+            value = ( value << 8 ) | reg[ First + i ];
+        }
+        return static_cast< value_type >( value );
+    }
+
+    static constexpr void encode( value_type value, unsigned char *reg )
+    {
+        for ( int i = 0; i < Width; i++ )
+        {
+            reg[ First + i ] = ( value >> ( 8 * i ) ) & 0xFF;
+        }
+    }
+};
+
+
+#include "powercape_regs.hpp"
+
+
+namespace detail {
+
+template < typename... R >
+constexpr unsigned char span_first()
+{
+    return std::min( { R::first... } );
+}
+
+template < typename... R >
+constexpr unsigned char span_last()
+{
+    return std::max( { R::last... } );
+}
+
+template < typename... R >
+constexpr int needs_capability()
+{
+    return std::max( { R::min_capability... } );
+}
+
+// registers follow one another without gaps or overlap
+template < typename R >
+constexpr bool contiguous()
+{
+    return true;
+}
+
+template < typename R, typename S, typename... T >
+constexpr bool contiguous()
+{
+    return R::last + 1 == S::first && contiguous< S, T... >();
+}
+
+template < std::size_t... I >
+constexpr bool tiles_register_file( std::index_sequence< I... > )
+{
+    return contiguous< std::tuple_element_t< I, regs::all >... >() &&
+           std::tuple_element_t< 0, regs::all >::first == 0 &&
+           std::tuple_element_t< sizeof...( I ) - 1, regs::all >::last == NUM_REGISTERS - 1;
+}
+
+static_assert( tiles_register_file( std::make_index_sequence< std::tuple_size_v< regs::all > >() ),
+               "register descriptors must cover avr/registers.h exactly" );
+
+}   // namespace detail
+
+
+template < int Capability = capability_unknown >
+class cape {
+public:
+    cape( int i2c_bus = CAPE_I2C_BUS, int avr_address = AVR_ADDRESS )
+        : handle_( cape_open( i2c_bus, avr_address ) )
+    {
+        cape_registers regs;
+
+        if ( handle_ == nullptr )
+        {
+            return;
+        }
+
+        if ( cape_snapshot_range_r( handle_, &regs, REG_EXTENDED, 2 ) != 0 )
+        {
+            close();
+            return;
+        }
+
+        capability_ = cape_snapshot_capability( &regs );
+        if ( Capability != capability_unknown && capability_ < Capability )
+        {
+            fprintf( stderr, "Cape capability %d, %d is needed\n", capability_, Capability );
+            close();
+        }
+    }
+
+    ~cape()
+    {
+        cape_close_r( handle_ );
+    }
+
+    cape( const cape & ) = delete;
+    cape &operator=( const cape & ) = delete;
+
+    cape( cape &&other ) noexcept
+        : handle_( std::exchange( other.handle_, nullptr ) ), capability_( other.capability_ )
+    {
+    }
+
+    explicit operator bool() const
+    {
+        return handle_ != nullptr;
+    }
+
+    int capability() const
+    {
+        return capability_;
+    }
+
+    // for the C interface
+    cape_t *get() const
+    {
+        return handle_;
+    }
+
+    // One burst read over the span of the registers named; a value for one
+    // register, a tuple for several
+    template < typename... R >
+    auto read() const
+    {
+        constexpr unsigned char first = detail::span_first< R... >();
+        constexpr unsigned char last = detail::span_last< R... >();
+
+        static_assert( sizeof...( R ) > 0, "name at least one register" );
+        check_capability< R... >();
+
+        using result = std::conditional_t< sizeof...( R ) == 1,
+                                           std::tuple_element_t< 0, std::tuple< typename R::value_type... > >,
+                                           std::tuple< typename R::value_type... > >;
+        cape_registers regs;
+
+        if ( !allowed< R... >() || cape_snapshot_range_r( handle_, &regs, first, last - first + 1 ) != 0 )
+        {
+            return std::optional< result >();
+        }
+
+        if constexpr ( sizeof...( R ) == 1 )
+        {
+            return std::optional< result >( ( R::decode( regs.reg ), ... ) );
+        }
+        else
+        {
+            return std::optional< result >( result( R::decode( regs.reg )... ) );
+        }
+    }
+
+    // A value known when compiling is checked when compiling
+    template < typename R, unsigned long Value >
+    int write()
+    {
+        static_assert( R::valid( Value ), "value out of the register's range" );
+        return write< R >( static_cast< typename R::value_type >( Value ) );
+    }
+
+    // One burst write of adjacent registers, each value checked against its
+    // register's range; 0 on success
+    template < typename... R >
+    int write( typename R::value_type... values )
+    {
+        static_assert( sizeof...( R ) > 0, "name at least one register" );
+        static_assert( ( ( R::mode == reg_access::read_write ) && ... ), "register is read only" );
+        static_assert( detail::contiguous< R... >(), "a burst writes adjacent registers in order" );
+        check_capability< R... >();
+
+        constexpr unsigned char first = detail::span_first< R... >();
+        constexpr unsigned char last = detail::span_last< R... >();
+        cape_registers regs;
+
+        if ( !allowed< R... >() || !( R::valid( values ) && ... ) )
+        {
+            return 1;
+        }
+
+        ( R::encode( values, regs.reg ), ... );
+        return cape_register_block_write_r( handle_, first, &regs.reg[ first ], last - first + 1 ) == 0 ? 0 : 1;
+    }
+
+private:
+    void close()
+    {
+        cape_close_r( handle_ );
+        handle_ = nullptr;
+    }
+
+    template < typename... R >
+    static constexpr void check_capability()
+    {
+        static_assert( Capability == capability_unknown ||
+                       detail::needs_capability< R... >() <= Capability,
+                       "register needs a newer firmware capability than the cape declared" );
+    }
+
+    template < typename... R >
+    bool allowed() const
+    {
+        if ( handle_ == nullptr )
+        {
+            return false;
+        }
+        if constexpr ( Capability == capability_unknown )
+        {
+            if ( detail::needs_capability< R... >() > capability_ )
+            {
+                fprintf( stderr, "Register needs capability %d, the cape has %d\n",
+                         detail::needs_capability< R... >(), capability_ );
+                return false;
+            }
+        }
+        return true;
+    }
+
+    cape_t *handle_;
+    int capability_ = capability_basic;
+};
+
+}   // namespace capesdk
+
+#endif
@@ -0,0 +1,36 @@
+// generated by regmap.awk from registers.map, do not edit 
+
+// Included by powercape.hpp inside namespace capesdk
+
+namespace regs {
+
+using mcusr           = descriptor< REG_MCUSR, 1, reg_access::read_only, capability_basic, 0, 0xFF >;
+using osccal          = descriptor< REG_OSCCAL, 1, reg_access::read_write, capability_basic, 0, 0xFF >;
+using status          = descriptor< REG_STATUS, 1, reg_access::read_only, capability_basic, 0, 0xFF >;
+using control         = descriptor< REG_CONTROL, 1, reg_access::read_write, capability_basic, 0, 0xFF >;
+using start_enable    = descriptor< REG_START_ENABLE, 1, reg_access::read_write, capability_basic, 0, START_ALL >;
+using start_reason    = descriptor< REG_START_REASON, 1, reg_access::read_write, capability_basic, 0, START_ALL >;
+using restart_hours   = descriptor< REG_RESTART_HOURS, 1, reg_access::read_write, capability_basic, 0, 0xFF >;
+using restart_minutes = descriptor< REG_RESTART_MINUTES, 1, reg_access::read_write, capability_basic, 0, 59 >;
+using restart_seconds = descriptor< REG_RESTART_SECONDS, 1, reg_access::read_write, capability_basic, 0, 59 >;
+using seconds         = descriptor< REG_SECONDS_0, 4, reg_access::read_write, capability_basic, 0, 0xFFFFFFFF >;
+using extended        = descriptor< REG_EXTENDED, 1, reg_access::read_only, capability_basic, 0, 0xFF >;
+using capability      = descriptor< REG_CAPABILITY, 1, reg_access::read_only, CAPABILITY_RTC, 0, 0xFF >;
+using board_type      = descriptor< REG_BOARD_TYPE, 1, reg_access::read_only, CAPABILITY_WDT, 0, 0xFF >;
+using board_revision  = descriptor< REG_BOARD_REV, 1, reg_access::read_only, CAPABILITY_WDT, 0, 0xFF >;
+using board_stepping  = descriptor< REG_BOARD_STEP, 1, reg_access::read_only, CAPABILITY_WDT, 0, 0xFF >;
+using wdt_reset       = descriptor< REG_WDT_RESET, 1, reg_access::read_write, CAPABILITY_WDT, 0, 0xFF >;
+using wdt_power       = descriptor< REG_WDT_POWER, 1, reg_access::read_write, CAPABILITY_WDT, 0, 0xFF >;
+using wdt_stop        = descriptor< REG_WDT_STOP, 1, reg_access::read_write, CAPABILITY_WDT, 0, 0xFF >;
+using wdt_start       = descriptor< REG_WDT_START, 1, reg_access::read_write, CAPABILITY_WDT, 0, 0xFF >;
+using i2c_address     = descriptor< REG_I2C_ADDRESS, 1, reg_access::read_write, CAPABILITY_ADDR, 0x08, 0x77 >;
+using charge_current  = descriptor< REG_I2C_ICHARGE, 1, reg_access::read_write, CAPABILITY_CHARGE, 1, 3 >;
+using charge_timer    = descriptor< REG_I2C_TCHARGE, 1, reg_access::read_write, CAPABILITY_CHARGE, 3, 10 >;
+
+// every register once, in order
+using all = std::tuple< mcusr, osccal, status, control, start_enable, start_reason, restart_hours,
+                        restart_minutes, restart_seconds, seconds, extended, capability, board_type,
+                        board_revision, board_stepping, wdt_reset, wdt_power, wdt_stop, wdt_start,
+                        i2c_address, charge_current, charge_timer >;
+
+}   // namespace regs
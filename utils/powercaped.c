@@ -0,0 +1,716 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * powercaped.c
+ *
+ * Resident daemon that keeps the cape bus open, holds a cached register
+ * and INA219 snapshot and serves clients over a unix socket. The snapshot
+ * can also be exported as Prometheus metrics, written to a textfile for
+ * node_exporter after every refresh or served over HTTP on loopback.
+ */
+
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "powercaped.h"
+#include "ina.h"
+#include "telemetry.h"
+
+#define PCD_MAX_CLIENTS     16
+
+// a metrics client on loopback sends its request as it connects; one that
+// does not is dropped after this long rather than stall the daemon
+#define METRICS_REQUEST_MS  100
+
+static int i2c_bus = CAPE_I2C_BUS;
+static int avr_address = AVR_ADDRESS;
+static int ina_address = INA_ADDRESS;
+static int interval_ms = 1000;
+static int foreground = 0;
+static int publish = 0;
+static const char *socket_path = PCD_SOCKET_PATH;
+static const char *textfile = NULL;
+static int metrics_port = 0;
+
+static volatile sig_atomic_t running = 1;
+
+static cape_t *cape;
+static ina_t *ina;
+static struct telemetry_page *page;
+
+// most recent bus readings handed out to clients
+static struct {
+    cape_registers regs;
+    int regs_valid;
+    float mv;
+    float ma;
+    int ina_valid;
+    struct timespec stamp;
+    struct timespec wall;           // CLOCK_REALTIME of the refresh
+} cache;
+
+
+void show_usage( char *progname )
+{
+    fprintf( stderr, "Usage: %s [OPTION] \n", progname );
+    fprintf( stderr, "   Options:\n" );
+    fprintf( stderr, "      -h --help           Show usage.\n" );
+    fprintf( stderr, "      -f --foreground     Do not detach from the terminal.\n" );
+    fprintf( stderr, "      -i --interval n     Refresh cached readings every n ms (default %d).\n", interval_ms );
+    fprintf( stderr, "      -m --telemetry      Publish readings to shared memory %s.\n", TELEMETRY_SHM_NAME );
+    fprintf( stderr, "      -s --socket path    Listen on path (default %s).\n", PCD_SOCKET_PATH );
+    fprintf( stderr, "      -x --textfile path  Write Prometheus metrics to path after every refresh.\n" );
+    fprintf( stderr, "      -p --metrics-port n Serve Prometheus metrics on 127.0.0.1:n/metrics.\n" );
+    fprintf( stderr, "      -b --bus n          I2C bus (default %d).\n", CAPE_I2C_BUS );
+    fprintf( stderr, "      -a --address addr   Cape AVR address (default 0x%02X).\n", AVR_ADDRESS );
+    fprintf( stderr, "      -n --ina addr       INA219 address (default 0x%02X).\n", INA_ADDRESS );
+    exit( 1 );
+}
+
+
+void parse( int argc, char *argv[] )
+{
+    while( 1 )
+    {
+        static const struct option lopts[] =
+        {
+            { "help",        0, 0, 'h' },
+            { "foreground",  0, 0, 'f' },
+            { "interval",    1, 0, 'i' },
+            { "telemetry",   0, 0, 'm' },
+            { "socket",      1, 0, 's' },
+            { "textfile",    1, 0, 'x' },
+            { "metrics-port", 1, 0, 'p' },
+            { "bus",         1, 0, 'b' },
+            { "address",     1, 0, 'a' },
+            { "ina",         1, 0, 'n' },
+            { NULL,          0, 0, 0 },
+        };
+        int c;
+
+        c = getopt_long( argc, argv, "hfmi:s:x:p:b:a:n:", lopts, NULL );
+
+        if( c == -1 )
+            break;
+
+        switch( c )
+        {
+            case 'f':
+            {
+                foreground = 1;
+                break;
+            }
+
+            case 'i':
+            {
+                interval_ms = atoi( optarg );
+                if ( interval_ms <= 0 )
+                {
+                    show_usage( argv[ 0 ] );
+                }
+                break;
+            }
+
+            case 'm':
+            {
+                publish = 1;
+                break;
+            }
+
+            case 's':
+            {
+                socket_path = optarg;
+                break;
+            }
+
+            case 'x':
+            {
+                textfile = optarg;
+                break;
+            }
+
+            case 'p':
+            {
+                metrics_port = atoi( optarg );
+                if ( metrics_port <= 0 || metrics_port > 65535 )
+                {
+                    show_usage( argv[ 0 ] );
+                }
+                break;
+            }
+
+            case 'b':
+            {
+                i2c_bus = (int)strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            case 'a':
+            {
+                avr_address = (int)strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            case 'n':
+            {
+                ina_address = (int)strtol( optarg, NULL, 0 );
+                break;
+            }
+
+            default:
+            case 'h':
+            {
+                show_usage( argv[ 0 ] );
+                break;
+            }
+        }
+    }
+}
+
+
+void on_signal( int sig )
+{
+    running = 0;
+}
+
+
+static int elapsed_ms( const struct timespec *since )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) * 1000 + ( now.tv_nsec - since->tv_nsec ) / 1000000;
+}
+
+
+void publish_telemetry( void )
+{
+    struct telemetry_sample sample;
+    struct timespec now;
+
+    memset( &sample, 0, sizeof( sample ) );
+    clock_gettime( CLOCK_REALTIME, &now );
+    sample.stamp_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    if ( cache.regs_valid )
+    {
+        sample.valid |= TELEMETRY_CAPE;
+        sample.status = cache.regs.reg[ REG_STATUS ];
+        sample.start_reason = cache.regs.reg[ REG_START_REASON ];
+        sample.rtc = cape_snapshot_seconds( &cache.regs );
+    }
+
+    if ( cache.ina_valid )
+    {
+        sample.valid |= TELEMETRY_INA;
+        sample.mv = cache.mv;
+        sample.ma = cache.ma;
+    }
+
+    telemetry_publish( page, &sample );
+}
+
+
+static void metric( FILE *f, const char *name, const char *type, const char *help )
+{
+    fprintf( f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+}
+
+
+static void metric_flags( FILE *f, const char *name, const char *help, unsigned char c )
+{
+    metric( f, name, "gauge", help );
+    fprintf( f, "%s{source=\"button\"} %d\n", name, !!( c & START_BUTTON ) );
+    fprintf( f, "%s{source=\"external\"} %d\n", name, !!( c & START_EXTERNAL ) );
+    fprintf( f, "%s{source=\"power_good\"} %d\n", name, !!( c & START_PWRGOOD ) );
+    fprintf( f, "%s{source=\"timeout\"} %d\n", name, !!( c & START_TIMEOUT ) );
+}
+
+
+// The cached snapshot in the Prometheus text format; nothing is read here
+void write_metrics( FILE *f )
+{
+    const unsigned char *reg = cache.regs.reg;
+    int capability = cape_snapshot_capability( &cache.regs );
+
+    metric( f, "powercape_up", "gauge", "1 when the last read of the cape registers succeeded" );
+    fprintf( f, "powercape_up %d\n", cache.regs_valid );
+    metric( f, "powercape_ina_up", "gauge", "1 when the last read of the INA219 succeeded" );
+    fprintf( f, "powercape_ina_up %d\n", cache.ina_valid );
+    metric( f, "powercape_refresh_timestamp_seconds", "gauge", "When the readings were taken" );
+    fprintf( f, "powercape_refresh_timestamp_seconds %ld.%03ld\n",
+             (long)cache.wall.tv_sec, cache.wall.tv_nsec / 1000000 );
+
+    if ( cache.ina_valid )
+    {
+        metric( f, "powercape_voltage_volts", "gauge", "Battery voltage, INA219 bus register" );
+        fprintf( f, "powercape_voltage_volts %.3f\n", cache.mv / 1000 );
+        metric( f, "powercape_current_amperes", "gauge", "Battery current, INA219 shunt register" );
+        fprintf( f, "powercape_current_amperes %.4f\n", cache.ma / 1000 );
+        metric( f, "powercape_power_watts", "gauge", "Battery power, voltage times current" );
+        fprintf( f, "powercape_power_watts %.4f\n", cache.mv * cache.ma / 1000000 );
+    }
+
+    if ( !cache.regs_valid )
+    {
+        return;
+    }
+
+    metric( f, "powercape_capability", "gauge", "Firmware capability level, -1 before the extended registers" );
+    fprintf( f, "powercape_capability %d\n", capability );
+    metric_flags( f, "powercape_start_reason", "What powered the board on", reg[ REG_START_REASON ] );
+    metric_flags( f, "powercape_start_enabled", "What may power the board on", reg[ REG_START_ENABLE ] );
+    metric( f, "powercape_restart_countdown_seconds", "gauge", "Power on countdown while off" );
+    fprintf( f, "powercape_restart_countdown_seconds %d\n",
+             reg[ REG_RESTART_HOURS ] * 3600 + reg[ REG_RESTART_MINUTES ] * 60 + reg[ REG_RESTART_SECONDS ] );
+    metric( f, "powercape_status", "gauge", "Status register inputs" );
+    fprintf( f, "powercape_status{input=\"power_good\"} %d\n", !!( reg[ REG_STATUS ] & STATUS_POWER_GOOD ) );
+    fprintf( f, "powercape_status{input=\"button\"} %d\n", !!( reg[ REG_STATUS ] & STATUS_BUTTON ) );
+    fprintf( f, "powercape_status{input=\"opto\"} %d\n", !!( reg[ REG_STATUS ] & STATUS_OPTO ) );
+    metric( f, "powercape_charger_enabled", "gauge", "1 when the charger is enabled" );
+    fprintf( f, "powercape_charger_enabled %d\n", !!( reg[ REG_CONTROL ] & CONTROL_CE ) );
+
+    if ( capability >= CAPABILITY_RTC )
+    {
+        // the cape counts whole seconds, so this is good to about one
+        metric( f, "powercape_rtc_offset_seconds", "gauge", "Cape RTC minus system time" );
+        fprintf( f, "powercape_rtc_offset_seconds %lld\n",
+                 (long long)cape_snapshot_seconds( &cache.regs ) - cache.wall.tv_sec );
+    }
+
+    if ( capability >= CAPABILITY_WDT )
+    {
+        metric( f, "powercape_watchdog_seconds", "gauge", "Watchdog countdowns, 0 when disarmed" );
+        fprintf( f, "powercape_watchdog_seconds{watchdog=\"reset\"} %d\n", reg[ REG_WDT_RESET ] );
+        fprintf( f, "powercape_watchdog_seconds{watchdog=\"power\"} %d\n", reg[ REG_WDT_POWER ] );
+        fprintf( f, "powercape_watchdog_seconds{watchdog=\"stop\"} %d\n", reg[ REG_WDT_STOP ] );
+        fprintf( f, "powercape_watchdog_seconds{watchdog=\"start\"} %d\n", reg[ REG_WDT_START ] );
+    }
+
+    if ( capability >= CAPABILITY_CHARGE )
+    {
+        metric( f, "powercape_charge_current_limit_amperes", "gauge", "Charge current setting" );
+        fprintf( f, "powercape_charge_current_limit_amperes %.3f\n", reg[ REG_I2C_ICHARGE ] / 3.0 );
+        metric( f, "powercape_charge_timer_hours", "gauge", "Charge timer setting" );
+        fprintf( f, "powercape_charge_timer_hours %d\n", reg[ REG_I2C_TCHARGE ] );
+    }
+}
+
+
+// Written to a temporary file and renamed, so a scrape never sees half
+void write_textfile( void )
+{
+    char tmp[ 256 ];
+    FILE *f;
+
+    snprintf( tmp, sizeof( tmp ), "%s.tmp", textfile );
+    f = fopen( tmp, "w" );
+    if ( f == NULL )
+    {
+        fprintf( stderr, "Error writing %s: %s\n", tmp, strerror( errno ) );
+        return;
+    }
+
+    write_metrics( f );
+    if ( fclose( f ) != 0 || rename( tmp, textfile ) != 0 )
+    {
+        fprintf( stderr, "Error writing %s: %s\n", textfile, strerror( errno ) );
+        unlink( tmp );
+    }
+}
+
+
+void refresh( void )
+{
+    cache.regs_valid = ( cape_snapshot_r( cape, &cache.regs ) == 0 );
+
+    cache.ina_valid = 0;
+    if ( ina != NULL )
+    {
+        cache.ina_valid = ( ina_get_voltage( ina, &cache.mv ) == 0 &&
+                            ina_get_current( ina, &cache.ma ) == 0 );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &cache.stamp );
+    clock_gettime( CLOCK_REALTIME, &cache.wall );
+
+    if ( page != NULL )
+    {
+        publish_telemetry();
+    }
+
+    if ( textfile != NULL )
+    {
+        write_textfile();
+    }
+}
+
+
+void handle_request( const struct pcd_request *req, struct pcd_reply *reply )
+{
+    int wrote = 1;
+
+    memset( reply, 0, sizeof( *reply ) );
+
+    switch ( req->op )
+    {
+        case PCD_OP_SNAPSHOT:
+        {
+            wrote = 0;
+            reply->rc = 0;
+            break;
+        }
+
+        case PCD_OP_BOOT:
+        {
+            reply->rc = cape_enter_bootloader_r( cape );
+            break;
+        }
+
+        case PCD_OP_WRITE_RTC:
+        {
+            reply->rc = cape_write_rtc_r( cape );
+            break;
+        }
+
+        // arg is an int32, the setters take a byte: 257 must not become 1
+        case PCD_OP_CHARGE:
+        {
+            reply->rc = -1;
+            if ( req->arg >= CHARGE_RATE_LOW && req->arg <= CHARGE_RATE_HIGH )
+            {
+                reply->rc = cape_charge_rate_r( cape, req->arg );
+            }
+            break;
+        }
+
+        case PCD_OP_CHARGE_TIME:
+        {
+            reply->rc = -1;
+            if ( req->arg >= CHARGE_TIME_MIN && req->arg <= CHARGE_TIME_MAX )
+            {
+                reply->rc = cape_charge_time_r( cape, req->arg );
+            }
+            break;
+        }
+
+        case PCD_OP_POWER_DOWN:
+        {
+            reply->rc = -1;
+            if ( req->arg >= POWER_DOWN_MIN_SEC && req->arg <= POWER_DOWN_MAX_SEC )
+            {
+                reply->rc = cape_power_down_r( cape, req->arg );
+            }
+            break;
+        }
+
+        case PCD_OP_POWER_ON:
+        {
+            reply->rc = cape_power_on_r( cape, req->arg );
+            break;
+        }
+
+        case PCD_OP_WAKE_AT:
+        {
+            reply->rc = -1;
+            if ( req->arg >= 0 && req->arg <= POWER_DOWN_MAX_SEC )
+            {
+                reply->rc = cape_wake_at_r( cape, (time_t)req->when, req->arg );
+            }
+            break;
+        }
+
+        default:
+        {
+            wrote = 0;
+            reply->rc = -1;
+            break;
+        }
+    }
+
+    // writes change the register file, so never answer with stale data
+    if ( wrote || ( req->flags & PCD_FLAG_FRESH ) )
+    {
+        refresh();
+    }
+
+    reply->age_ms = elapsed_ms( &cache.stamp );
+    reply->regs_valid = cache.regs_valid;
+    reply->ina_valid = cache.ina_valid;
+    reply->mv = cache.mv;
+    reply->ma = cache.ma;
+    reply->regs = cache.regs;
+}
+
+
+int open_socket( void )
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+    if ( fd < 0 )
+    {
+        fprintf( stderr, "Error creating socket: %s\n", strerror( errno ) );
+        return -1;
+    }
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, socket_path, sizeof( addr.sun_path ) - 1 );
+    unlink( socket_path );
+
+    if ( bind( fd, (struct sockaddr*)&addr, sizeof( addr ) ) < 0 ||
+         listen( fd, PCD_MAX_CLIENTS ) < 0 )
+    {
+        fprintf( stderr, "Error binding %s: %s\n", socket_path, strerror( errno ) );
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+
+int open_metrics( void )
+{
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd;
+
+    fd = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if ( fd < 0 )
+    {
+        fprintf( stderr, "Error creating metrics socket: %s\n", strerror( errno ) );
+        return -1;
+    }
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( metrics_port );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+    if ( bind( fd, (struct sockaddr*)&addr, sizeof( addr ) ) < 0 ||
+         listen( fd, PCD_MAX_CLIENTS ) < 0 )
+    {
+        fprintf( stderr, "Error binding 127.0.0.1:%d: %s\n", metrics_port, strerror( errno ) );
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+
+// One request per connection, answered from the cache and closed
+void serve_metrics( int listener )
+{
+    struct pollfd pfd;
+    char request[ 512 ];
+    char *body = NULL;
+    size_t size = 0;
+    FILE *f;
+    int n = 0;
+
+    pfd.fd = accept4( listener, NULL, NULL, SOCK_CLOEXEC );
+    if ( pfd.fd < 0 )
+    {
+        return;
+    }
+    pfd.events = POLLIN;
+
+    if ( poll( &pfd, 1, METRICS_REQUEST_MS ) == 1 )
+    {
+        n = recv( pfd.fd, request, sizeof( request ) - 1, MSG_DONTWAIT );
+    }
+    if ( n <= 0 )
+    {
+        close( pfd.fd );
+        return;
+    }
+    request[ n ] = '\0';
+
+    if ( strncmp( request, "GET /metrics ", 13 ) != 0 )
+    {
+        dprintf( pfd.fd, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n" );
+    }
+    else if ( ( f = open_memstream( &body, &size ) ) != NULL )
+    {
+        write_metrics( f );
+        fclose( f );
+        dprintf( pfd.fd, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\nConnection: close\r\n\r\n", size );
+        send( pfd.fd, body, size, MSG_NOSIGNAL );
+        free( body );
+    }
+
+    // let the client see the whole reply before the close
+    shutdown( pfd.fd, SHUT_WR );
+    while ( recv( pfd.fd, request, sizeof( request ), MSG_DONTWAIT ) > 0 )
+        ;
+    close( pfd.fd );
+}
+
+
+int main( int argc, char *argv[] )
+{
+    struct pollfd fds[ PCD_MAX_CLIENTS + 2 ];
+    int nfds = 2;                   // the two listeners, then clients
+    int listener, metrics = -1;
+    int i;
+
+    parse( argc, argv );
+
+    cape = cape_open( i2c_bus, avr_address );
+    if ( cape == NULL )
+    {
+        exit( 1 );
+    }
+
+    // clients see the age of the daemon's own copy, so each refresh must
+    // read the bus; only registers fixed in the firmware stay cached
+    for ( i = 0; i < cape_register_count; i++ )
+    {
+        const cape_register_desc *desc = &cape_register_map[ i ];
+        int j;
+
+        if ( !( desc->flags & REG_FLAG_FIXED ) )
+        {
+            for ( j = desc->first; j < desc->first + desc->width; j++ )
+            {
+                cape_cache_ttl_r( cape, j, CAPE_CACHE_NEVER );
+            }
+        }
+    }
+
+    // the cape is still usable without the power monitor; its sampling
+    // gives way to other programs' commands on the bus
+    ina = ina_open( i2c_bus, ina_address );
+    if ( ina != NULL )
+    {
+        transport_set_priority( ina->bus, BUSLOCK_MONITOR );
+    }
+
+    if ( publish )
+    {
+        page = telemetry_create( TELEMETRY_SHM_NAME );
+        if ( page == NULL )
+        {
+            exit( 1 );
+        }
+    }
+
+    listener = open_socket();
+    if ( listener < 0 )
+    {
+        exit( 1 );
+    }
+
+    if ( metrics_port != 0 )
+    {
+        metrics = open_metrics();
+        if ( metrics < 0 )
+        {
+            exit( 1 );
+        }
+    }
+
+    if ( !foreground && daemon( 0, 0 ) < 0 )
+    {
+        fprintf( stderr, "Error detaching: %s\n", strerror( errno ) );
+        exit( 1 );
+    }
+
+    signal( SIGINT, on_signal );
+    signal( SIGTERM, on_signal );
+    signal( SIGPIPE, SIG_IGN );
+
+    refresh();
+
+    fds[ 0 ].fd = listener;
+    fds[ 0 ].events = POLLIN;
+    fds[ 1 ].fd = metrics;          // poll skips it when negative
+    fds[ 1 ].events = POLLIN;
+    fds[ 1 ].revents = 0;
+
+    while ( running )
+    {
+        int timeout = interval_ms - elapsed_ms( &cache.stamp );
+
+        if ( timeout <= 0 )
+        {
+            refresh();
+            timeout = interval_ms;
+        }
+
+        if ( poll( fds, nfds, timeout ) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            fprintf( stderr, "poll failed: %s\n", strerror( errno ) );
+            break;
+        }
+
+        for ( i = nfds - 1; i > 1; i-- )
+        {
+            struct pcd_request req;
+            struct pcd_reply reply;
+
+            if ( fds[ i ].revents == 0 )
+                continue;
+
+            if ( ( fds[ i ].revents & POLLIN ) &&
+                 recv( fds[ i ].fd, &req, sizeof( req ), 0 ) == sizeof( req ) )
+            {
+                handle_request( &req, &reply );
+                if ( send( fds[ i ].fd, &reply, sizeof( reply ), MSG_NOSIGNAL ) == sizeof( reply ) )
+                    continue;
+            }
+
+            // hangup, short message or failed reply drops the client
+            close( fds[ i ].fd );
+            fds[ i ] = fds[ --nfds ];
+        }
+
+        if ( fds[ 0 ].revents & POLLIN )
+        {
+            int fd = accept4( listener, NULL, NULL, SOCK_CLOEXEC );
+
+            if ( fd >= 0 && nfds < PCD_MAX_CLIENTS + 2 )
+            {
+                fds[ nfds ].fd = fd;
+                fds[ nfds ].events = POLLIN;
+                fds[ nfds ].revents = 0;
+                nfds++;
+            }
+            else if ( fd >= 0 )
+            {
+                close( fd );
+            }
+        }
+
+        if ( fds[ 1 ].revents & POLLIN )
+        {
+            serve_metrics( metrics );
+        }
+    }
+
+    for ( i = 2; i < nfds; i++ )
+    {
+        close( fds[ i ].fd );
+    }
+    close( listener );
+    if ( metrics >= 0 )
+    {
+        close( metrics );
+    }
+    unlink( socket_path );
+
+    ina_close( ina );
+    cape_close_r( cape );
+    return 0;
+}
@@ -0,0 +1,61 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * powercaped.h
+ *
+ * Request/reply protocol spoken by powercaped over its unix socket. Each
+ * request and reply is a single SOCK_SEQPACKET message.
+ */
+
+#ifndef __POWERCAPED_H__
+#define __POWERCAPED_H__
+#include <stdint.h>
+#include "powercape.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PCD_SOCKET_PATH     "/run/powercaped.sock"
+
+// request flags
+#define PCD_FLAG_FRESH      0x01    // refresh the cache before replying
+
+typedef enum {
+    PCD_OP_SNAPSHOT,                // cached register and ina219 snapshot
+    PCD_OP_BOOT,
+    PCD_OP_WRITE_RTC,
+    PCD_OP_CHARGE,
+    PCD_OP_CHARGE_TIME,
+    PCD_OP_POWER_DOWN,
+    PCD_OP_POWER_ON,
+    PCD_OP_WAKE_AT,                 // when wake time, arg power down delay
+} pcd_op;
+
+struct pcd_request {
+    uint32_t op;
+    uint32_t flags;
+    int32_t arg;
+    uint32_t when;                  // cape rtc seconds, as wide as the rtc
+};
+
+struct pcd_reply {
+    int32_t rc;
+    uint32_t age_ms;                // age of the cached data
+    int32_t regs_valid;
+    int32_t ina_valid;
+    float mv;
+    float ma;
+    cape_registers regs;
+};
+
+
+int pcd_connect(const char *path);
+
+int pcd_call(int fd, pcd_op op, int flags, int arg, struct pcd_reply *reply);
+
+int pcd_call_at(int fd, pcd_op op, int flags, int arg, uint32_t when, struct pcd_reply *reply);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+/* generated by regmap.awk from registers.map, do not edit */
+
+#include "powercape.h"
+
+
+const cape_register_desc cape_register_map[] = {
+    { "mcusr", "AVR register", REG_MCUSR, 1, -1, REG_FLAG_RO, 0, 0xFF },
+    { "osccal", "AVR register", REG_OSCCAL, 1, -1, 0, 0, 0xFF },
+    { "status", "", REG_STATUS, 1, -1, REG_FLAG_RO, 0, 0xFF },
+    { "control", "", REG_CONTROL, 1, -1, 0, 0, 0xFF },
+    { "start_enable", "", REG_START_ENABLE, 1, -1, 0, 0, START_ALL },
+    { "start_reason", "", REG_START_REASON, 1, -1, 0, 0, START_ALL },
+    { "restart_hours", "Countdown hours", REG_RESTART_HOURS, 1, -1, 0, 0, 0xFF },
+    { "restart_minutes", "Countdown minutes", REG_RESTART_MINUTES, 1, -1, 0, 0, 59 },
+    { "restart_seconds", "Countdown seconds", REG_RESTART_SECONDS, 1, -1, 0, 0, 59 },
+    { "seconds", "Uptime counter/clock", REG_SECONDS_0, 4, -1, 0, 0, 0xFFFFFFFF },
+    { "extended", "Indicator that extended register set follows", REG_EXTENDED, 1, -1, REG_FLAG_RO | REG_FLAG_FIXED, 0, 0xFF },
+    { "capability", "Firmware version/feature \"level\"", REG_CAPABILITY, 1, CAPABILITY_RTC, REG_FLAG_RO | REG_FLAG_FIXED, 0, 0xFF },
+    { "board_type", "Board type (ie: BeagleBone, Pi, etc.)", REG_BOARD_TYPE, 1, CAPABILITY_WDT, REG_FLAG_RO | REG_FLAG_EEPROM | REG_FLAG_FIXED, 0, 0xFF },
+    { "board_revision", "Hardware revision (if known) in ASCII (ie: 'A')", REG_BOARD_REV, 1, CAPABILITY_WDT, REG_FLAG_RO | REG_FLAG_EEPROM | REG_FLAG_FIXED, 0, 0xFF },
+    { "board_stepping", "Hardware stepping (if known) in ASCII (ie: '1')", REG_BOARD_STEP, 1, CAPABILITY_WDT, REG_FLAG_RO | REG_FLAG_EEPROM | REG_FLAG_FIXED, 0, 0xFF },
+    { "wdt_reset", "Reset watchdog countdown register (seconds, 0 to disable)", REG_WDT_RESET, 1, CAPABILITY_WDT, 0, 0, 0xFF },
+    { "wdt_power", "Power-cycle watchdog countdown register (seconds, 0 to disable)", REG_WDT_POWER, 1, CAPABILITY_WDT, 0, 0, 0xFF },
+    { "wdt_stop", "Power-off countdown (single-shot seconds, 0 to disable)", REG_WDT_STOP, 1, CAPABILITY_WDT, 0, 0, 0xFF },
+    { "wdt_start", "Start-up activity watchdog countdown (seconds, 0 to disable)", REG_WDT_START, 1, CAPABILITY_WDT, 0, 0, 0xFF },
+    { "i2c_address", "Slave address to use on I2C interface", REG_I2C_ADDRESS, 1, CAPABILITY_ADDR, REG_FLAG_EEPROM | REG_FLAG_ERASE, 0x08, 0x77 },
+    { "charge_current", "Charge current (0-3)/3 amp", REG_I2C_ICHARGE, 1, CAPABILITY_CHARGE, REG_FLAG_CLAMP | REG_FLAG_EEPROM, 1, 3 },
+    { "charge_timer", "Charger timer in hours (3-10)", REG_I2C_TCHARGE, 1, CAPABILITY_CHARGE, REG_FLAG_CLAMP | REG_FLAG_EEPROM, 3, 10 },
+};
+
+const int cape_register_count = sizeof( cape_register_map ) / sizeof( cape_register_map[ 0 ] );
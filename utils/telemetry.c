@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "telemetry.h"
+
+#define SAMPLE_WORDS    ( sizeof( struct telemetry_sample ) / sizeof( uint32_t ) )
+
+
+struct telemetry_page *telemetry_create( const char *name )
+{
+    int fd;
+    struct telemetry_page *page;
+
+    fd = shm_open( name, O_RDWR | O_CREAT, 0644 );
+    if ( fd < 0 )
+    {
+        fprintf( stderr, "Error creating %s: %s\n", name, strerror( errno ) );
+        return NULL;
+    }
+
+    if ( ftruncate( fd, sizeof( struct telemetry_page ) ) < 0 )
+    {
+        fprintf( stderr, "Error sizing %s: %s\n", name, strerror( errno ) );
+        close( fd );
+        return NULL;
+    }
+
+    page = mmap( NULL, sizeof( struct telemetry_page ), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( page == MAP_FAILED )
+    {
+        fprintf( stderr, "Error mapping %s: %s\n", name, strerror( errno ) );
+        return NULL;
+    }
+
+    // a restarted publisher keeps the sequence running so readers that
+    // straddle the restart still see a change
+    if ( page->magic != TELEMETRY_MAGIC || page->version != TELEMETRY_VERSION )
+    {
+        memset( page, 0, sizeof( *page ) );
+        page->version = TELEMETRY_VERSION;
+        __atomic_store_n( &page->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE );
+    }
+    else if ( page->seq & 1 )
+    {
+        __atomic_store_n( &page->seq, page->seq + 1, __ATOMIC_RELEASE );
+    }
+
+    return page;
+}
+
+
+const struct telemetry_page *telemetry_attach( const char *name )
+{
+    int fd;
+    struct telemetry_page *page;
+
+    fd = shm_open( name, O_RDONLY, 0 );
+    if ( fd < 0 )
+    {
+        fprintf( stderr, "Error opening %s: %s\n", name, strerror( errno ) );
+        return NULL;
+    }
+
+    page = mmap( NULL, sizeof( struct telemetry_page ), PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( page == MAP_FAILED )
+    {
+        fprintf( stderr, "Error mapping %s: %s\n", name, strerror( errno ) );
+        return NULL;
+    }
+
+    if ( __atomic_load_n( &page->magic, __ATOMIC_ACQUIRE ) != TELEMETRY_MAGIC ||
+         page->version != TELEMETRY_VERSION )
+    {
+        fprintf( stderr, "%s is not a version %d telemetry page\n", name, TELEMETRY_VERSION );
+        munmap( page, sizeof( struct telemetry_page ) );
+        return NULL;
+    }
+
+    return page;
+}
+
+
+void telemetry_publish( struct telemetry_page *page, const struct telemetry_sample *sample )
+{
+    uint32_t *dst = (uint32_t*)&page->sample;
+    const uint32_t *src = (const uint32_t*)sample;
+    uint32_t seq = page->seq;
+    unsigned int i;
+
+    __atomic_store_n( &page->seq, seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+
+    for ( i = 0; i < SAMPLE_WORDS; i++ )
+    {
+        __atomic_store_n( &dst[ i ], src[ i ], __ATOMIC_RELAXED );
+    }
+
+    __atomic_store_n( &page->seq, seq + 2, __ATOMIC_RELEASE );
+}
+
+
+int telemetry_read( const struct telemetry_page *page, struct telemetry_sample *sample )
+{
+    const uint32_t *src = (const uint32_t*)&page->sample;
+    uint32_t *dst = (uint32_t*)sample;
+    uint32_t seq0, seq1;
+    unsigned int i;
+
+    // retry until a copy is taken with no publish in progress or in between
+    do
+    {
+        seq0 = __atomic_load_n( &page->seq, __ATOMIC_ACQUIRE );
+        if ( seq0 & 1 )
+        {
+            continue;
+        }
+
+        for ( i = 0; i < SAMPLE_WORDS; i++ )
+        {
+            dst[ i ] = __atomic_load_n( &src[ i ], __ATOMIC_RELAXED );
+        }
+
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        seq1 = __atomic_load_n( &page->seq, __ATOMIC_RELAXED );
+    }
+    while ( ( seq0 & 1 ) || seq0 != seq1 );
+
+    // nothing published yet
+    return seq0 == 0 ? -1 : 0;
+}
@@ -0,0 +1,58 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * telemetry.h
+ *
+ * Shared memory page holding the latest cape and INA219 readings. One
+ * publisher writes it under a sequence lock; any number of readers take
+ * consistent copies without system calls once the page is mapped.
+ */
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_SHM_NAME  "/powercape"
+#define TELEMETRY_MAGIC     0x50434150      // "PCAP"
+#define TELEMETRY_VERSION   1
+
+// sample valid bits
+#define TELEMETRY_CAPE      0x01            // status, start reason and rtc
+#define TELEMETRY_INA       0x02            // voltage and current
+
+// one published reading, kept a whole number of 32 bit words
+struct telemetry_sample {
+    uint32_t valid;
+    uint32_t rtc;                   // cape REG_SECONDS_*
+    int64_t stamp_ns;               // CLOCK_REALTIME of the reading
+    float mv;
+    float ma;
+    uint8_t status;                 // REG_STATUS
+    uint8_t start_reason;           // REG_START_REASON
+    uint8_t reserved[ 2 ];
+};
+
+struct telemetry_page {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;                   // odd while the publisher is writing
+    uint32_t reserved;
+    struct telemetry_sample sample;
+};
+
+
+struct telemetry_page *telemetry_create(const char *name);
+
+const struct telemetry_page *telemetry_attach(const char *name);
+
+void telemetry_publish(struct telemetry_page *page, const struct telemetry_sample *sample);
+
+int telemetry_read(const struct telemetry_page *page, struct telemetry_sample *sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
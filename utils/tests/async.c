@@ -0,0 +1,120 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * tests/async.c
+ *
+ * Asynchronous API check against the emulated cape: submits one request
+ * of every op, waits on the eventfd with epoll and dispatches until the
+ * callbacks have run, checks their results, then checks that the request
+ * left without a callback neither keeps the eventfd readable nor is lost
+ * to cape_async_poll(). Exits 0 when everything passes.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "../capeasync.h"
+
+#define WAIT_MS     1000
+
+static int failed;
+static int called;
+
+
+static void check( int ok, const char *what )
+{
+    if ( !ok )
+    {
+        fprintf( stderr, "async: %s\n", what );
+        failed++;
+    }
+}
+
+
+static void written( cape_async_req *req, void *arg )
+{
+    check( req->rc == 0, "write failed" );
+    called++;
+}
+
+
+// Queued after the write, so it must see it
+static void snapshot( cape_async_req *req, void *arg )
+{
+    check( req->rc == 0, "snapshot failed" );
+    check( req->regs.reg[ REG_EXTENDED ] == 0x69, "snapshot has no extended marker" );
+    check( req->regs.reg[ REG_RESTART_HOURS ] == *(unsigned char*)arg, "snapshot missed the write" );
+    called++;
+}
+
+
+static void sampled( cape_async_req *req, void *arg )
+{
+    check( req->rc == 0, "ina219 sample failed" );
+    check( req->mv > 3800 && req->mv < 4000, "ina219 voltage out of the emulated range" );
+    check( req->ma > 200 && req->ma < 300, "ina219 current out of the emulated range" );
+    called++;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    static unsigned char hours = 5;
+    struct epoll_event ev;
+    cape_async_req *req;
+    cape_async *async;
+    cape_t *cape;
+    ina_t *ina;
+    int ep;
+
+    setenv( TRANSPORT_ENV, TRANSPORT_EMULATOR, 1 );
+    cape = cape_open( CAPE_I2C_BUS, AVR_ADDRESS );
+    ina = ina_open( CAPE_I2C_BUS, INA_ADDRESS );
+    async = cape != NULL && ina != NULL ? cape_async_start( cape, ina ) : NULL;
+    if ( async == NULL )
+    {
+        return 1;
+    }
+
+    ep = epoll_create1( EPOLL_CLOEXEC );
+    ev.events = EPOLLIN;
+    ev.data.ptr = async;
+    epoll_ctl( ep, EPOLL_CTL_ADD, cape_async_fd( async ), &ev );
+
+    check( cape_async_write( async, REG_RESTART_HOURS, hours, written, NULL ) == 0, "write not queued" );
+    check( cape_async_snapshot( async, snapshot, &hours ) == 0, "snapshot not queued" );
+    check( cape_async_rtc( async, NULL, NULL ) == 0, "rtc not queued" );
+    check( cape_async_ina_sample( async, sampled, NULL ) == 0, "sample not queued" );
+
+    while ( called < 3 )
+    {
+        if ( epoll_wait( ep, &ev, 1, WAIT_MS ) != 1 )
+        {
+            check( 0, "callbacks did not run" );
+            break;
+        }
+        cape_async_dispatch( async );
+    }
+
+    // only the rtc request is left, and it must not look like news
+    check( epoll_wait( ep, &ev, 1, 0 ) == 0, "eventfd readable with nothing to dispatch" );
+    check( cape_async_dispatch( async ) == 0, "dispatch ran a request twice" );
+
+    req = cape_async_poll( async );
+    check( req != NULL && req->op == CAPE_ASYNC_RTC, "rtc request lost" );
+    if ( req != NULL )
+    {
+        check( req->rc == 0, "rtc read failed" );
+        check( req->rtc >= time( NULL ) - 2 && req->rtc <= time( NULL ), "rtc is not the emulated clock" );
+        free( req );
+    }
+    check( cape_async_poll( async ) == NULL, "extra completed request" );
+
+    cape_async_stop( async );
+    close( ep );
+    ina_close( ina );
+    cape_close_r( cape );
+
+    printf( "async: %s\n", failed == 0 ? "ok" : "FAILED" );
+    return failed != 0;
+}
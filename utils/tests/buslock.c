@@ -0,0 +1,232 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * tests/buslock.c
+ *
+ * Bus lock check against the emulated cape: while the bus is held, an
+ * INA219 monitor read (0x40, BUSLOCK_MONITOR) starts waiting, then a cape
+ * read at watchdog priority (0x21, BUSLOCK_URGENT) from another process.
+ * Both must wait although neither address is the one held, and on release
+ * the watchdog read must go first although it came second. Then an
+ * urgent wait on a bus held for good must give up in time, and a lock
+ * file planted as a symlink must be refused. Exits 0 when all pass.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "../transport.h"
+#include "../powercape.h"
+
+#define ROUNDS      10
+#define SETTLE_US   30000
+
+
+static const transport_ops *emulator_ops;
+static transport_ops tagged_ops;
+static int tag_fd;
+static char tag;
+
+
+// The emulated transfer, with the tag down the pipe first: this runs with
+// the bus held, so the pipe gets the tags in the order the bus was taken
+static int tagged_transfer( transport_t *t, struct i2c_msg *msgs, int nmsgs )
+{
+    if ( write( tag_fd, &tag, 1 ) != 1 )
+    {
+        return -1;
+    }
+
+    return emulator_ops->transfer( t, msgs, nmsgs );
+}
+
+
+// Child: one register read at address and priority
+static pid_t reader( int out, int address, buslock_priority priority, char name )
+{
+    struct i2c_msg msgs[ 2 ];
+    uint8_t reg = 0;
+    uint8_t data[ 2 ];
+    transport_t *t;
+    pid_t pid;
+    int rc;
+
+    pid = fork();
+    if ( pid != 0 )
+    {
+        return pid;
+    }
+
+    t = transport_open( 1 );
+    if ( t == NULL || t->lock < 0 )
+    {
+        _exit( 1 );
+    }
+    transport_set_priority( t, priority );
+    emulator_ops = t->ops;
+    tagged_ops = *t->ops;
+    tagged_ops.transfer = tagged_transfer;
+    t->ops = &tagged_ops;
+    tag_fd = out;
+    tag = name;
+
+    msgs[ 0 ].addr = address;
+    msgs[ 0 ].flags = 0;
+    msgs[ 0 ].len = 1;
+    msgs[ 0 ].buf = &reg;
+    msgs[ 1 ].addr = address;
+    msgs[ 1 ].flags = I2C_M_RD;
+    msgs[ 1 ].len = 2;
+    msgs[ 1 ].buf = data;
+    rc = transport_transfer( t, msgs, 2 );
+
+    _exit( rc != 0 || t->stats.lock_waits != 1 );
+}
+
+
+static int round_ok( int round )
+{
+    char order[ 3 ] = "";
+    pid_t monitor, urgent;
+    int fds[ 2 ];
+    int status;
+    int rc = 1;
+    int lock;
+
+    lock = buslock_open( 1 );
+    if ( lock < 0 || pipe( fds ) != 0 )
+    {
+        return 0;
+    }
+    fcntl( fds[ 0 ], F_SETFL, O_NONBLOCK );
+
+    // held as a command would hold it, at neither reader's address
+    if ( buslock_acquire( lock, BUSLOCK_NORMAL, NULL ) != 0 )
+    {
+        fprintf( stderr, "round %d: bus lock busy at start\n", round );
+        return 0;
+    }
+
+    monitor = reader( fds[ 1 ], INA_ADDRESS, BUSLOCK_MONITOR, 'M' );
+    usleep( SETTLE_US );
+    urgent = reader( fds[ 1 ], AVR_ADDRESS, BUSLOCK_URGENT, 'U' );
+    usleep( SETTLE_US );
+
+    if ( read( fds[ 0 ], order, 1 ) == 1 )
+    {
+        fprintf( stderr, "round %d: %c read the bus while it was held\n", round, order[ 0 ] );
+        rc = 0;
+    }
+
+    buslock_release( lock, NULL );
+    waitpid( urgent, &status, 0 );
+    rc &= WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+    waitpid( monitor, &status, 0 );
+    rc &= WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+
+    if ( rc && ( read( fds[ 0 ], order, 2 ) != 2 || strcmp( order, "UM" ) != 0 ) )
+    {
+        fprintf( stderr, "round %d: got the bus in order %s, expected UM\n", round, order );
+        rc = 0;
+    }
+
+    close( fds[ 0 ] );
+    close( fds[ 1 ] );
+    buslock_close( lock );
+    return rc;
+}
+
+
+// A holder that never lets go keeps an urgent request waiting only so long
+static int urgent_gives_up( void )
+{
+    struct timespec t0, t1;
+    int holder, waiter;
+    long ms;
+    int rc;
+
+    holder = buslock_open( 1 );
+    waiter = buslock_open( 1 );
+    if ( holder < 0 || waiter < 0 || buslock_acquire( holder, BUSLOCK_MONITOR, NULL ) != 0 )
+    {
+        return 0;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    rc = buslock_acquire( waiter, BUSLOCK_URGENT, NULL );
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+    ms = ( t1.tv_sec - t0.tv_sec ) * 1000 + ( t1.tv_nsec - t0.tv_nsec ) / 1000000;
+
+    buslock_close( waiter );
+    buslock_close( holder );
+    if ( rc != -1 || errno != ETIMEDOUT || ms < BUSLOCK_URGENT_WAIT_MS - 1 || ms > 2 * BUSLOCK_URGENT_WAIT_MS )
+    {
+        fprintf( stderr, "urgent wait on a held bus: rc %d after %ld ms\n", rc, ms );
+        return 0;
+    }
+    return 1;
+}
+
+
+// A lock file planted as a symlink is refused and its target left alone
+static int symlink_refused( const char *dir )
+{
+    char path[ 64 ], target[ 64 ];
+    struct stat st;
+    int fd;
+
+    snprintf( path, sizeof( path ), "%s/i2c-2.lock", dir );
+    snprintf( target, sizeof( target ), "%s/target", dir );
+    fd = open( target, O_WRONLY | O_CREAT, 0600 );
+    close( fd );
+    if ( fd < 0 || symlink( target, path ) != 0 )
+    {
+        return 0;
+    }
+
+    fd = buslock_open( 2 );
+    stat( target, &st );
+    unlink( path );
+    unlink( target );
+    if ( fd >= 0 || ( st.st_mode & 0777 ) != 0600 )
+    {
+        fprintf( stderr, "symlinked lock file was used\n" );
+        buslock_close( fd );
+        return 0;
+    }
+    return 1;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    char dir[] = "/tmp/buslockXXXXXX";
+    char path[ 64 ];
+    int failed = 0;
+    int i;
+
+    if ( mkdtemp( dir ) == NULL )
+    {
+        perror( "mkdtemp" );
+        return 1;
+    }
+    setenv( BUSLOCK_DIR_ENV, dir, 1 );
+    setenv( TRANSPORT_ENV, TRANSPORT_EMULATOR, 1 );
+
+    for ( i = 0; i < ROUNDS; i++ )
+    {
+        failed += !round_ok( i );
+    }
+    failed += !urgent_gives_up();
+    failed += !symlink_refused( dir );
+
+    snprintf( path, sizeof( path ), "%s/i2c-1.lock", dir );
+    unlink( path );
+    rmdir( dir );
+
+    printf( "bus lock: %s\n", failed == 0 ? "ok" : "FAILED" );
+    return failed != 0;
+}
@@ -0,0 +1,8 @@
+// expect: a burst writes adjacent registers in order
+// Registers with a gap between them cannot share one write
+#include "powercape.hpp"
+
+void f( capesdk::cape<> &c )
+{
+    c.write< capesdk::regs::wdt_reset, capesdk::regs::wdt_stop >( 1, 2 );
+}
@@ -0,0 +1,8 @@
+// expect: register needs a newer firmware capability
+// A register introduced after the capability the cape is declared with
+#include "powercape.hpp"
+
+void f( capesdk::cape< CAPABILITY_WDT > &c )
+{
+    c.read< capesdk::regs::charge_current >();
+}
@@ -0,0 +1,8 @@
+// expect: value out of the register's range
+// A constant the register does not accept: hosts do not turn charging off
+#include "powercape.hpp"
+
+void f( capesdk::cape< CAPABILITY_CHARGE > &c )
+{
+    c.write< capesdk::regs::charge_current, CHARGE_RATE_ZERO >();
+}
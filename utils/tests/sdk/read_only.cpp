@@ -0,0 +1,8 @@
+// expect: register is read only
+// A write to a register the host may only read
+#include "powercape.hpp"
+
+void f( capesdk::cape<> &c )
+{
+    c.write< capesdk::regs::status >( 1 );
+}
@@ -0,0 +1,48 @@
+// Rickie Kerndt <rkerndt@cs.uoregon.edu>
+// tests/sdk/use.cpp
+//
+// The SDK in use, built and run against the emulated cape by make sdkcheck:
+// a burst read across two registers, a checked write and its read back.
+
+#include <cstdlib>
+#include <ctime>
+#include "powercape.hpp"
+
+using namespace capesdk;
+
+
+int main()
+{
+    setenv( TRANSPORT_ENV, TRANSPORT_EMULATOR, 1 );
+
+    cape< CAPABILITY_CHARGE > c;
+    if ( !c )
+    {
+        return 1;
+    }
+
+    auto t = c.read< regs::seconds, regs::capability >();
+    if ( !t || std::get< 1 >( *t ) < CAPABILITY_CHARGE ||
+         std::get< 0 >( *t ) + 2 < static_cast< uint32_t >( time( nullptr ) ) )
+    {
+        fprintf( stderr, "sdk: burst read of seconds and capability is wrong\n" );
+        return 1;
+    }
+
+    if ( c.write< regs::charge_current, CHARGE_RATE_MED >() != 0 ||
+         c.write< regs::wdt_reset, regs::wdt_power >( 30, 60 ) != 0 )
+    {
+        fprintf( stderr, "sdk: write failed\n" );
+        return 1;
+    }
+
+    auto w = c.read< regs::charge_current, regs::charge_timer, regs::wdt_reset >();
+    if ( !w || std::get< 0 >( *w ) != CHARGE_RATE_MED || std::get< 2 >( *w ) != 30 )
+    {
+        fprintf( stderr, "sdk: read back does not match the writes\n" );
+        return 1;
+    }
+
+    printf( "sdk: ok\n" );
+    return 0;
+}
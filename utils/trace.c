@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+// largest record trace_write() builds
+#define TRACE_RECORD_MAX    ( 10 + TRACE_MAX_MSGS * 4 + TRACE_MAX_DATA )
+
+struct _trace_writer {
+    int fd;
+};
+
+
+static void put16( unsigned char *p, unsigned int v )
+{
+    p[ 0 ] = v & 0xFF;
+    p[ 1 ] = ( v >> 8 ) & 0xFF;
+}
+
+
+static unsigned int get16( const unsigned char *p )
+{
+    return p[ 0 ] | ( p[ 1 ] << 8 );
+}
+
+
+// Appends, so the cape and ina219 transports of one process (or several
+// processes) can share a file; the header goes in only when it is new
+trace_writer *trace_create( const char *path, int i2c_bus )
+{
+    trace_writer *w;
+    struct stat st;
+
+    w = calloc( 1, sizeof( trace_writer ) );
+    if ( w == NULL )
+    {
+        fprintf( stderr, "Out of memory allocating trace\n" );
+        return NULL;
+    }
+
+    w->fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    if ( w->fd < 0 || fstat( w->fd, &st ) < 0 )
+    {
+        fprintf( stderr, "Error opening trace %s: %s\n", path, strerror( errno ) );
+        if ( w->fd >= 0 )
+            close( w->fd );
+        free( w );
+        return NULL;
+    }
+
+    if ( st.st_size == 0 )
+    {
+        unsigned char header[ TRACE_HEADER_SIZE ] = { 0 };
+
+        memcpy( header, TRACE_MAGIC, 4 );
+        header[ 4 ] = TRACE_VERSION;
+        header[ 5 ] = i2c_bus;
+        if ( write( w->fd, header, sizeof( header ) ) != sizeof( header ) )
+        {
+            fprintf( stderr, "Error writing trace %s: %s\n", path, strerror( errno ) );
+        }
+    }
+
+    return w;
+}
+
+
+// Each record goes out in one write() so appends from several writers
+// never interleave
+void trace_write( trace_writer *w, const struct i2c_msg *msgs, int nmsgs, int err )
+{
+    unsigned char record[ TRACE_RECORD_MAX ];
+    struct timespec now;
+    uint64_t us;
+    int len = 0;
+    int i;
+
+    if ( nmsgs > TRACE_MAX_MSGS )
+    {
+        return;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    for ( i = 0; i < 8; i++ )
+    {
+        record[ len++ ] = ( us >> ( 8 * i ) ) & 0xFF;
+    }
+    record[ len++ ] = nmsgs;
+    record[ len++ ] = err > 255 ? 255 : err;
+
+    for ( i = 0; i < nmsgs; i++ )
+    {
+        if ( len + 4 + msgs[ i ].len > TRACE_RECORD_MAX )
+        {
+            return;
+        }
+
+        record[ len++ ] = msgs[ i ].addr;
+        record[ len++ ] = ( msgs[ i ].flags & I2C_M_RD ) ? TRACE_READ : 0;
+        put16( &record[ len ], msgs[ i ].len );
+        len += 2;
+        memcpy( &record[ len ], msgs[ i ].buf, msgs[ i ].len );
+        len += msgs[ i ].len;
+    }
+
+    // a lost record shows up when the trace is read, never as a bus error
+    if ( write( w->fd, record, len ) != len )
+    {
+        return;
+    }
+}
+
+
+void trace_close( trace_writer *w )
+{
+    if ( w == NULL )
+    {
+        return;
+    }
+
+    close( w->fd );
+    free( w );
+}
+
+
+FILE *trace_open( const char *path, int *i2c_bus )
+{
+    unsigned char header[ TRACE_HEADER_SIZE ];
+    FILE *f;
+
+    f = fopen( path, "r" );
+    if ( f == NULL )
+    {
+        fprintf( stderr, "Error opening trace %s: %s\n", path, strerror( errno ) );
+        return NULL;
+    }
+
+    if ( fread( header, 1, sizeof( header ), f ) != sizeof( header ) ||
+         memcmp( header, TRACE_MAGIC, 4 ) != 0 || header[ 4 ] != TRACE_VERSION )
+    {
+        fprintf( stderr, "%s is not a version %d trace\n", path, TRACE_VERSION );
+        fclose( f );
+        return NULL;
+    }
+
+    if ( i2c_bus != NULL )
+    {
+        *i2c_bus = header[ 5 ];
+    }
+
+    return f;
+}
+
+
+// Next transaction: 1 when one was read, 0 at the end, -1 on a damaged file
+int trace_read( FILE *f, trace_transaction *tr )
+{
+    unsigned char head[ 10 ];
+    size_t got;
+    int used = 0;
+    int i;
+
+    got = fread( head, 1, sizeof( head ), f );
+    if ( got == 0 && feof( f ) )
+    {
+        return 0;
+    }
+    if ( got != sizeof( head ) )
+    {
+        return -1;
+    }
+
+    tr->time_us = 0;
+    for ( i = 7; i >= 0; i-- )
+    {
+        tr->time_us = ( tr->time_us << 8 ) | head[ i ];
+    }
+    tr->nmsgs = head[ 8 ];
+    tr->err = head[ 9 ];
+    if ( tr->nmsgs > TRACE_MAX_MSGS )
+    {
+        return -1;
+    }
+
+    for ( i = 0; i < tr->nmsgs; i++ )
+    {
+        unsigned char m[ 4 ];
+        int len;
+
+        if ( fread( m, 1, sizeof( m ), f ) != sizeof( m ) )
+        {
+            return -1;
+        }
+
+        len = get16( &m[ 2 ] );
+        if ( used + len > TRACE_MAX_DATA ||
+             fread( &tr->data[ used ], 1, len, f ) != (size_t)len )
+        {
+            return -1;
+        }
+
+        tr->msgs[ i ].addr = m[ 0 ];
+        tr->msgs[ i ].flags = ( m[ 1 ] & TRACE_READ ) ? I2C_M_RD : 0;
+        tr->msgs[ i ].len = len;
+        tr->msgs[ i ].buf = &tr->data[ used ];
+        used += len;
+    }
+
+    return 1;
+}
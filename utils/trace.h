@@ -0,0 +1,66 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * trace.h
+ *
+ * Binary record of bus transactions. Setting POWERCAPE_TRACE to a file
+ * name makes every transport append each attempted transaction to it:
+ * when, the status, and for each message the address, direction, length
+ * and bytes (written, or as read back). capetrace dumps, replays and
+ * compares traces.
+ *
+ * File layout, little endian: an 8 byte header ("PCT1", version, bus,
+ * two reserved bytes), then records of
+ *
+ *     u64 time_us  u8 nmsgs  u8 err  { u8 addr  u8 flags  u16 len  data[len] } * nmsgs
+ *
+ * where time_us is CLOCK_MONOTONIC and err the errno of a failed attempt.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/i2c.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_ENV           "POWERCAPE_TRACE"
+#define TRACE_MAGIC         "PCT1"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_SIZE   8
+
+// message flags
+#define TRACE_READ          0x01
+
+// limits on what one record may hold
+#define TRACE_MAX_MSGS      8
+#define TRACE_MAX_DATA      1024
+
+typedef struct _trace_writer trace_writer;
+
+// one transaction read back from a trace, msgs point into data
+typedef struct _trace_transaction {
+    uint64_t time_us;
+    int err;
+    int nmsgs;
+    struct i2c_msg msgs[ TRACE_MAX_MSGS ];
+    unsigned char data[ TRACE_MAX_DATA ];
+} trace_transaction;
+
+
+trace_writer *trace_create(const char *path, int i2c_bus);
+
+void trace_write(trace_writer *w, const struct i2c_msg *msgs, int nmsgs, int err);
+
+void trace_close(trace_writer *w);
+
+FILE *trace_open(const char *path, int *i2c_bus);
+
+int trace_read(FILE *f, trace_transaction *tr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
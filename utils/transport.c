@@ -0,0 +1,410 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include "transport.h"
+
+// misc constants
+#define I2C_MAX_DEVICE_NAME 0x0C     // maximum length of i2c filename
+
+
+static int i2cdev_transfer( transport_t *t, struct i2c_msg *msgs, int nmsgs )
+{
+    struct i2c_rdwr_ioctl_data xfer;
+
+    xfer.msgs = msgs;
+    xfer.nmsgs = nmsgs;
+
+    STAT_ADD( t, syscalls, 1 );
+    if ( ioctl( t->handle, I2C_RDWR, &xfer ) != nmsgs )
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void i2cdev_close( transport_t *t )
+{
+    if ( close( t->handle ) == -1 )
+    {
+        fprintf( stderr, "Error closing handler: (%d) %s\n", errno, strerror( errno ) );
+    }
+}
+
+
+static const transport_ops i2cdev_ops = {
+    .name = "i2c-dev",
+    .transfer = i2cdev_transfer,
+    .close = i2cdev_close,
+};
+
+
+static transport_t *i2cdev_open( int i2c_bus, int locked )
+{
+    transport_t *t;
+    char filename[ I2C_MAX_DEVICE_NAME ];
+
+    t = calloc( 1, sizeof( transport_t ) );
+    if ( t == NULL )
+    {
+        fprintf( stderr, "Out of memory allocating transport\n" );
+        return NULL;
+    }
+
+    snprintf( filename, I2C_MAX_DEVICE_NAME, "/dev/i2c-%d", i2c_bus );
+    t->handle = open( filename, O_RDWR | O_CLOEXEC );
+    if ( t->handle == -1 )
+    {
+        fprintf( stderr, "Failed to open %s: (%d) %s\n", filename, errno, strerror( errno ) );
+        free( t );
+        return NULL;
+    }
+
+    transport_init( t, &i2cdev_ops, i2c_bus );
+    if ( locked )
+    {
+        t->lock = buslock_open( i2c_bus );
+    }
+    return t;
+}
+
+
+transport_t *transport_open_i2cdev( int i2c_bus )
+{
+    return i2cdev_open( i2c_bus, 1 );
+}
+
+
+void transport_init( transport_t *t, const transport_ops *ops, int i2c_bus )
+{
+    const char *retries = getenv( TRANSPORT_RETRY_ENV );
+
+    t->ops = ops;
+    t->i2c_bus = i2c_bus;
+    t->retries = retries != NULL ? atoi( retries ) : TRANSPORT_RETRIES;
+    t->backoff_us = TRANSPORT_BACKOFF_US;
+    t->lock = -1;
+    t->priority = BUSLOCK_NORMAL;
+    clock_gettime( CLOCK_MONOTONIC, &t->opened );
+
+    if ( getenv( TRACE_ENV ) != NULL )
+    {
+        t->trace = trace_create( getenv( TRACE_ENV ), i2c_bus );
+    }
+}
+
+
+void transport_set_retry( transport_t *t, int retries, int backoff_us )
+{
+    t->retries = retries;
+    t->backoff_us = backoff_us;
+}
+
+
+void transport_set_priority( transport_t *t, buslock_priority priority )
+{
+    t->priority = priority;
+}
+
+
+transport_t *transport_open( int i2c_bus )
+{
+    const char *backend = getenv( TRANSPORT_ENV );
+    transport_t *t;
+
+    if ( backend != NULL && strcmp( backend, TRANSPORT_EMULATOR ) == 0 )
+    {
+        t = transport_open_emulator( i2c_bus );
+        if ( t != NULL && getenv( BUSLOCK_DIR_ENV ) != NULL )
+        {
+            t->lock = buslock_open( i2c_bus );
+        }
+        return t;
+    }
+
+    return transport_open_i2cdev( i2c_bus );
+}
+
+
+// As transport_open(), without the bus lock and so without its lock file
+// and fcntl()s; for a single exchange early in boot, before /run/lock
+transport_t *transport_open_unlocked( int i2c_bus )
+{
+    const char *backend = getenv( TRANSPORT_ENV );
+
+    if ( backend != NULL && strcmp( backend, TRANSPORT_EMULATOR ) == 0 )
+    {
+        return transport_open_emulator( i2c_bus );
+    }
+
+    return i2cdev_open( i2c_bus, 0 );
+}
+
+
+// Clock periods for one transaction: a start or repeated start per message,
+// address and data bytes at nine clocks each with ack, and the final stop
+unsigned long transport_bus_bits( const struct i2c_msg *msgs, int nmsgs )
+{
+    unsigned long bits = 1;
+    int i;
+
+    for ( i = 0; i < nmsgs; i++ )
+    {
+        bits += 1 + 9 * ( 1 + msgs[ i ].len );
+    }
+
+    return bits;
+}
+
+
+// Errors a noisy or contended bus can produce; anything else (a bad
+// descriptor, a malformed message) fails the same way on every attempt
+static int transient( int err )
+{
+    switch ( err )
+    {
+        case EIO:
+        case EAGAIN:
+        case EBUSY:
+        case ENXIO:             // no ack, also while the avr writes eeprom
+        case EREMOTEIO:
+        case ETIMEDOUT:
+            return 1;
+    }
+
+    return 0;
+}
+
+
+static transport_op_type op_type( const struct i2c_msg *msgs, int nmsgs )
+{
+    int reads = 0;
+    int i;
+
+    for ( i = 0; i < nmsgs; i++ )
+    {
+        reads += ( msgs[ i ].flags & I2C_M_RD ) != 0;
+    }
+
+    if ( reads == 0 )
+        return TRANSPORT_OP_WRITE;
+    if ( reads == nmsgs )
+        return TRANSPORT_OP_READ;
+    return TRANSPORT_OP_WRITE_READ;
+}
+
+
+static int histogram_bucket( unsigned long ns )
+{
+    int shift;
+
+    if ( ns < ( 2 << TRANSPORT_HIST_SUB_BITS ) )
+    {
+        return ns;
+    }
+
+    // position of the top bit, less the bits kept for the sub-bucket
+    shift = 63 - __builtin_clzl( ns ) - TRANSPORT_HIST_SUB_BITS;
+    if ( ( shift + 2 ) << TRANSPORT_HIST_SUB_BITS > TRANSPORT_HIST_BUCKETS )
+    {
+        return TRANSPORT_HIST_BUCKETS - 1;
+    }
+
+    return ( ( shift + 1 ) << TRANSPORT_HIST_SUB_BITS ) + ( ns >> shift ) - ( 1 << TRANSPORT_HIST_SUB_BITS );
+}
+
+
+// Largest value that lands in bucket i
+static unsigned long histogram_upper( int i )
+{
+    int sub = 1 << TRANSPORT_HIST_SUB_BITS;
+    int shift;
+
+    if ( i < 2 * sub )
+    {
+        return i;
+    }
+
+    shift = ( i >> TRANSPORT_HIST_SUB_BITS ) - 1;
+    return ( ( (unsigned long)( sub + ( i & ( sub - 1 ) ) + 1 ) ) << shift ) - 1;
+}
+
+
+static void histogram_record( transport_histogram *h, unsigned long ns )
+{
+    unsigned long max = __atomic_load_n( &h->max_ns, __ATOMIC_RELAXED );
+
+    __atomic_fetch_add( &h->count[ histogram_bucket( ns ) ], 1, __ATOMIC_RELAXED );
+    __atomic_fetch_add( &h->total, 1, __ATOMIC_RELAXED );
+    while ( ns > max &&
+            !__atomic_compare_exchange_n( &h->max_ns, &max, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+}
+
+
+unsigned long transport_histogram_percentile( const transport_histogram *h, double p )
+{
+    unsigned long rank, seen = 0;
+    int i;
+
+    if ( h->total == 0 )
+    {
+        return 0;
+    }
+
+    rank = (unsigned long)( p * h->total + 0.5 );
+    if ( rank < 1 )
+        rank = 1;
+
+    for ( i = 0; i < TRANSPORT_HIST_BUCKETS; i++ )
+    {
+        seen += h->count[ i ];
+        if ( seen >= rank )
+        {
+            unsigned long upper = histogram_upper( i );
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+
+    return h->max_ns;
+}
+
+
+int transport_transfer( transport_t *t, struct i2c_msg *msgs, int nmsgs )
+{
+    struct timespec t0, t1;
+    int delay_us = t->backoff_us;
+    int attempt = 0;
+    unsigned long lock_calls = 0;
+    int locked = 0;
+    int rc;
+    int i;
+
+    // a wait for the lock is not bus latency; without the lock (an urgent
+    // wait that timed out) the transfer still goes ahead
+    if ( t->lock >= 0 && nmsgs > 0 )
+    {
+        rc = buslock_acquire( t->lock, t->priority, &lock_calls );
+        if ( rc > 0 )
+        {
+            STAT_ADD( t, lock_waits, 1 );
+        }
+        locked = rc >= 0;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    while ( 1 )
+    {
+        errno = 0;
+        rc = t->ops->transfer( t, msgs, nmsgs );
+
+        if ( t->trace != NULL )
+        {
+            int err = rc == 0 ? 0 : errno != 0 ? errno : EIO;
+
+            trace_write( t->trace, msgs, nmsgs, err );
+            errno = err;
+        }
+
+        // handles attached to one transport may run on different threads
+        STAT_ADD( t, transfers, 1 );
+        STAT_ADD( t, messages, nmsgs );
+        STAT_ADD( t, bus_bits, transport_bus_bits( msgs, nmsgs ) );
+        for ( i = 0; i < nmsgs; i++ )
+        {
+            STAT_ADD( t, bytes, msgs[ i ].len );
+        }
+
+        if ( rc == 0 || attempt >= t->retries || !transient( errno ) )
+            break;
+
+        attempt++;
+        STAT_ADD( t, retries, 1 );
+        usleep( delay_us );
+        delay_us = delay_us * 2 < TRANSPORT_BACKOFF_MAX_US ? delay_us * 2 : TRANSPORT_BACKOFF_MAX_US;
+    }
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+    if ( locked )
+    {
+        buslock_release( t->lock, &lock_calls );
+    }
+    STAT_ADD( t, syscalls, lock_calls );
+
+    histogram_record( &t->stats.latency[ op_type( msgs, nmsgs ) ],
+                      ( t1.tv_sec - t0.tv_sec ) * 1000000000UL + t1.tv_nsec - t0.tv_nsec );
+    if ( rc != 0 )
+    {
+        STAT_ADD( t, errors, 1 );
+    }
+
+    return rc;
+}
+
+
+// Counters, latency percentiles per transfer shape and how much of the
+// time since the bus was opened the modeled wire time would fill
+void transport_print_stats( FILE *f, transport_t *t )
+{
+    static const char *names[ TRANSPORT_OP_TYPES ] = { "write", "read", "write+read" };
+    struct timespec now;
+    double elapsed, busy;
+    int i;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    elapsed = ( now.tv_sec - t->opened.tv_sec ) + ( now.tv_nsec - t->opened.tv_nsec ) / 1e9;
+    busy = (double)t->stats.bus_bits / TRANSPORT_BUS_HZ;
+
+    fprintf( f, "%s bus %d: %lu transfers, %lu retries, %lu errors, %lu bytes, %lu syscalls\n",
+             t->ops->name, t->i2c_bus, t->stats.transfers, t->stats.retries,
+             t->stats.errors, t->stats.bytes, t->stats.syscalls );
+    if ( t->lock >= 0 )
+    {
+        fprintf( f, "bus lock waited for %lu transfers\n", t->stats.lock_waits );
+    }
+    // utilization means little over a single short command
+    if ( elapsed >= 1.0 )
+    {
+        fprintf( f, "bus busy %.3f s of %.3f s (%.1f%% at %d kHz)\n",
+                 busy, elapsed, 100.0 * busy / elapsed, TRANSPORT_BUS_HZ / 1000 );
+    }
+    else
+    {
+        fprintf( f, "bus busy %.3f s at %d kHz\n", busy, TRANSPORT_BUS_HZ / 1000 );
+    }
+
+    for ( i = 0; i < TRANSPORT_OP_TYPES; i++ )
+    {
+        const transport_histogram *h = &t->stats.latency[ i ];
+
+        if ( h->total == 0 )
+            continue;
+
+        fprintf( f, "%-10s %8lu  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f us\n",
+                 names[ i ], h->total,
+                 transport_histogram_percentile( h, 0.50 ) / 1000.0,
+                 transport_histogram_percentile( h, 0.90 ) / 1000.0,
+                 transport_histogram_percentile( h, 0.99 ) / 1000.0,
+                 h->max_ns / 1000.0 );
+    }
+}
+
+
+void transport_close( transport_t *t )
+{
+    if ( t == NULL )
+    {
+        return;
+    }
+
+    t->ops->close( t );
+    buslock_close( t->lock );
+    trace_close( t->trace );
+    free( t );
+}
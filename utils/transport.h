@@ -0,0 +1,125 @@
+/* Rickie Kerndt <rkerndt@cs.uoregon.edu>
+ * transport.h
+ *
+ * I2C transport used by the cape and INA219 routines. A transport moves
+ * a list of i2c messages as one bus transaction (repeated starts between
+ * messages). Backends are the kernel i2c-dev interface and an in-process
+ * emulated cape. The i2c-dev backend holds the bus lock across each
+ * transfer and its retries; an emulated one from transport_open() does too
+ * when BUSLOCK_DIR_ENV is set, so emulated programs contend for the bus as
+ * on the board. transport_open_unlocked() leaves the lock out.
+ */
+
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+#include <stdio.h>
+#include <time.h>
+#include <linux/i2c.h>
+#include "trace.h"
+#include "buslock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// environment variable selecting the backend for transport_open()
+#define TRANSPORT_ENV           "POWERCAPE_TRANSPORT"
+#define TRANSPORT_EMULATOR      "emulator"
+
+// bus speed assumed when converting bit counts to time
+#define TRANSPORT_BUS_HZ        100000
+
+// retry policy for transient bus errors, the count can be overridden with
+// the environment variable; the delay doubles after each failed attempt
+#define TRANSPORT_RETRY_ENV     "POWERCAPE_RETRIES"
+#define TRANSPORT_RETRIES       2
+#define TRANSPORT_BACKOFF_US    500
+#define TRANSPORT_BACKOFF_MAX_US 8000
+
+// latency histograms are log-linear in ns: exact below 16, above that 8
+// buckets per power of two (within 12.5%), up to about 4 s
+#define TRANSPORT_HIST_SUB_BITS 3
+#define TRANSPORT_HIST_BUCKETS  240
+
+// transfers are histogrammed by shape
+typedef enum {
+    TRANSPORT_OP_WRITE,         // write messages only
+    TRANSPORT_OP_READ,          // read messages only
+    TRANSPORT_OP_WRITE_READ,    // write then read with repeated start
+    TRANSPORT_OP_TYPES
+} transport_op_type;
+
+typedef struct _transport_histogram {
+    unsigned long count[ TRANSPORT_HIST_BUCKETS ];
+    unsigned long total;
+    unsigned long max_ns;
+} transport_histogram;
+
+typedef struct _transport transport_t;
+
+// running totals kept by transport_transfer()
+typedef struct _transport_stats {
+    unsigned long transfers;    // bus transactions, start to stop
+    unsigned long messages;
+    unsigned long bytes;        // data bytes, not counting addresses
+    unsigned long syscalls;     // kernel entries, bus lock fcntl()s included
+                                // (emulator counts i2c-dev's)
+    unsigned long bus_bits;     // modeled clock periods on the wire
+    unsigned long errors;       // transfers that failed after all retries
+    unsigned long retries;      // repeated attempts, successful or not
+    unsigned long lock_waits;   // transfers that waited for another program
+    transport_histogram latency[ TRANSPORT_OP_TYPES ];   // including retries
+} transport_stats;
+
+typedef struct _transport_ops {
+    const char *name;
+    int (*transfer)(transport_t *t, struct i2c_msg *msgs, int nmsgs);
+    void (*close)(transport_t *t);
+} transport_ops;
+
+#define STAT_ADD( t, field, n )  __atomic_fetch_add( &( t )->stats.field, ( n ), __ATOMIC_RELAXED )
+
+struct _transport {
+    const transport_ops *ops;
+    int i2c_bus;
+    int handle;                 // i2c-dev file descriptor, -1 if unused
+    int retries;                // extra attempts after a transient error
+    int backoff_us;             // delay before the first retry
+    int lock;                   // bus lock file, -1 without one
+    buslock_priority priority;  // of this transport's bus lock requests
+    struct timespec opened;     // CLOCK_MONOTONIC, for bus utilization
+    trace_writer *trace;        // set from POWERCAPE_TRACE, else NULL
+    transport_stats stats;
+};
+
+
+transport_t *transport_open(int i2c_bus);
+
+transport_t *transport_open_unlocked(int i2c_bus);
+
+// for backends: fill in the common fields of a zeroed transport
+void transport_init(transport_t *t, const transport_ops *ops, int i2c_bus);
+
+transport_t *transport_open_i2cdev(int i2c_bus);
+
+transport_t *transport_open_emulator(int i2c_bus);
+
+int transport_transfer(transport_t *t, struct i2c_msg *msgs, int nmsgs);
+
+void transport_close(transport_t *t);
+
+void transport_set_retry(transport_t *t, int retries, int backoff_us);
+
+void transport_set_priority(transport_t *t, buslock_priority priority);
+
+unsigned long transport_bus_bits(const struct i2c_msg *msgs, int nmsgs);
+
+unsigned long transport_histogram_percentile(const transport_histogram *h, double p);
+
+void transport_print_stats(FILE *f, transport_t *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif